@@ -19,6 +19,7 @@
 #include "benchmark.h"
 #include "numa.h"
 
+#include <algorithm>
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
@@ -512,4 +513,127 @@ BenchmarkSetup setup_benchmark(std::istream& is) {
     return setup;
 }
 
+// Builds the list of commands for the "mctsbench" command, which measures the
+// number of MCTS playouts per second with 1, 2, 4, ... MCTS threads, up to the
+// given maximum. The arguments are the maximum number of MCTS threads, the
+// search time per position in milliseconds and the TT size in MB. Examples:
+//
+// mctsbench               : from 1 to 64 MCTS threads, 1 second per position
+// mctsbench 8 5000        : from 1 to 8 MCTS threads, 5 seconds per position
+MCTSBenchmarkSetup setup_mcts_benchmark(std::istream& is) {
+
+    // The opening and middlegame of the first speedtest game. MCTS is used only in
+    // the positions selected by the Shashin theory, and a game gives a realistic mix.
+    static constexpr int NUM_POSITIONS = 16;
+
+    MCTSBenchmarkSetup setup{};
+    int                maxThreads, movetime;
+
+    // Assign default values to missing arguments
+    if (!(is >> maxThreads))
+        maxThreads = 64;
+
+    if (!(is >> movetime))
+        movetime = 1000;
+
+    if (!(is >> setup.ttSize))
+        setup.ttSize = 16;
+
+    for (int t = 1; t <= std::max(maxThreads, 1); t *= 2)
+        setup.mctsThreads.push_back(t);
+
+    const std::vector<std::string>& game = BenchmarkPositions[0];
+
+    for (int i = 0; i < NUM_POSITIONS && i < int(game.size()); ++i)
+    {
+        setup.commands.emplace_back("position fen " + game[i]);
+        setup.commands.emplace_back("go movetime " + std::to_string(movetime));
+    }
+
+    return setup;
+}
+
+// Builds the list of commands for the "mctsreuse" command, which plays through the
+// first game of the speedtest positions and measures how many MCTS visits of the
+// previous moves are carried over to each new root. The arguments are the number of
+// MCTS threads, the search time per move in milliseconds, the TT size in MB and the
+// number of moves. Examples:
+//
+// mctsreuse               : 4 MCTS threads, 1 second per move, 20 moves
+// mctsreuse 8 5000 64 40  : 8 MCTS threads, 5 seconds per move, TT = 64MB, 40 moves
+MCTSBenchmarkSetup setup_mcts_reuse_benchmark(std::istream& is) {
+
+    MCTSBenchmarkSetup setup{};
+    int                threads, movetime, moves;
+
+    // Assign default values to missing arguments
+    if (!(is >> threads))
+        threads = 4;
+
+    if (!(is >> movetime))
+        movetime = 1000;
+
+    if (!(is >> setup.ttSize))
+        setup.ttSize = 16;
+
+    if (!(is >> moves))
+        moves = 20;
+
+    setup.mctsThreads.push_back(std::max(threads, 1));
+
+    // The positions of a game are two plies apart, so that each root is a grandchild
+    // of the previous one, as when the engine plays a game.
+    const std::vector<std::string>& game = BenchmarkPositions[0];
+
+    setup.commands.emplace_back("ucinewgame");
+
+    for (int i = 0; i < moves && i < int(game.size()); ++i)
+    {
+        setup.commands.emplace_back("position fen " + game[i]);
+        setup.commands.emplace_back("go movetime " + std::to_string(movetime));
+    }
+
+    return setup;
+}
+
+// Builds the list of commands for the "ttbench" command, which measures the latency of
+// the transposition table probes and the nodes per second with each NUMA placement of
+// the table. The arguments are the TT size in MB, the number of threads and the search
+// time per position in milliseconds. Examples:
+//
+// ttbench                : TT = 1024MB, all the threads, 1 second per position
+// ttbench 16384 128 5000 : TT = 16GB, 128 threads, 5 seconds per position
+TTBenchmarkSetup setup_tt_benchmark(std::istream& is) {
+
+    static constexpr int NUM_POSITIONS = 8;
+
+    TTBenchmarkSetup setup{};
+    int              movetime;
+
+    // Assign default values to missing arguments
+    if (!(is >> setup.ttSize))
+        setup.ttSize = 1024;
+
+    if (!(is >> setup.threads))
+        setup.threads = int(get_hardware_concurrency());
+
+    if (!(is >> movetime))
+        movetime = 1000;
+
+    // Enough probes to miss the caches, which hold a small part of a large table
+    setup.probes = size_t(1) << 22;
+
+    const std::vector<std::string>& game = BenchmarkPositions[0];
+
+    setup.commands.emplace_back("ucinewgame");
+
+    for (int i = 0; i < NUM_POSITIONS && i < int(game.size()); ++i)
+    {
+        setup.commands.emplace_back("position fen " + game[i]);
+        setup.commands.emplace_back("go movetime " + std::to_string(movetime));
+    }
+
+    return setup;
+}
+
 }  // namespace Alexander
\ No newline at end of file
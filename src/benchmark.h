@@ -19,6 +19,7 @@
 #ifndef BENCHMARK_H_INCLUDED
 #define BENCHMARK_H_INCLUDED
 
+#include <cstddef>
 #include <iosfwd>
 #include <string>
 #include <vector>
@@ -37,6 +38,24 @@ struct BenchmarkSetup {
 
 BenchmarkSetup setup_benchmark(std::istream&);
 
+struct MCTSBenchmarkSetup {
+    int                      ttSize;
+    std::vector<int>         mctsThreads;  // MCTS thread counts to measure, in increasing order
+    std::vector<std::string> commands;     // Commands to run for each MCTS thread count
+};
+
+MCTSBenchmarkSetup setup_mcts_benchmark(std::istream&);
+MCTSBenchmarkSetup setup_mcts_reuse_benchmark(std::istream&);
+
+struct TTBenchmarkSetup {
+    int                      ttSize;
+    int                      threads;
+    size_t                   probes;    // Probes per thread to measure the latency
+    std::vector<std::string> commands;  // Commands to run for each TT placement
+};
+
+TTBenchmarkSetup setup_tt_benchmark(std::istream&);
+
 }  // namespace Alexander
 
 #endif  // #ifndef BENCHMARK_H_INCLUDED
@@ -16,10 +16,18 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <unordered_map>
+#include <vector>
 
 #include "bitboard.h"
 #include "endgame.h"
+#include "misc.h"
 #include "movegen.h"
 
 namespace Alexander {
@@ -65,7 +73,59 @@ Square normalize(const Position& pos, Color strongSide, Square sq) {
 
 namespace Endgames {
 
-std::pair<Map<Value>, Map<ScaleFactor>> maps;
+Slot     table[TableSize];
+uint64_t multiplier;
+
+namespace {
+
+// The registered endgames, from which the table is built. Each key takes a slot, so
+// that a quarter of the table is enough for the hash to be perfect after a few tries.
+constexpr int MaxEndgames = TableSize / 4;
+
+Slot registered[MaxEndgames];
+int  registeredCount;
+
+Slot& registered_slot(Key key) {
+
+    for (int i = 0; i < registeredCount; ++i)
+        if (registered[i].key == key)
+            return registered[i];
+
+    assert(registeredCount < MaxEndgames);
+
+    registered[registeredCount] = {key, nullptr, nullptr};
+    return registered[registeredCount++];
+}
+
+// Finds a multiplier for which the slots of the registered keys are all different,
+// and fills the table with them
+void build() {
+
+    PRNG rng(1070372);
+
+    while (true)
+    {
+        bool perfect = true;
+        multiplier   = rng.rand<uint64_t>() | 1;
+        std::fill(std::begin(table), std::end(table), Slot{});
+
+        for (int i = 0; i < registeredCount && perfect; ++i)
+        {
+            Slot& slot = table[index(registered[i].key)];
+            perfect    = !slot.key;
+            slot       = registered[i];
+        }
+
+        if (perfect)
+            return;
+    }
+}
+
+}  // namespace
+
+void insert(Key key, const EndgameBase<Value>* eg) { registered_slot(key).evaluation = eg; }
+
+void insert(Key key, const EndgameBase<ScaleFactor>* eg) { registered_slot(key).scaling = eg; }
 
 void init() {
 
@@ -85,6 +145,52 @@ void init() {
     add<KBPKN>("KBPKN");
     add<KBPPKB>("KBPPKB");
     add<KRPPKRP>("KRPPKRP");
+
+    build();
+}
+
+
+/// benchmark() compares the cost of a probe of the table with the one of a lookup in
+/// a std::unordered_map of the same endgames. A quarter of the probed keys are those
+/// of registered endgames, the others are random material keys.
+
+void benchmark(uint64_t probes) {
+
+    using Clock = std::chrono::steady_clock;
+
+    std::unordered_map<Key, const EndgameBase<Value>*> map;
+    std::vector<Key>                                   keys(4096);
+    PRNG                                               rng(1070372);
+
+    for (int i = 0; i < registeredCount; ++i)
+        map[registered[i].key] = registered[i].evaluation;
+
+    for (size_t i = 0; i < keys.size(); ++i)
+        keys[i] = i % 4 ? rng.rand<Key>() : registered[rng.rand<uint32_t>() % registeredCount].key;
+
+    auto measure = [&](auto&& lookup) {
+        const auto start = Clock::now();
+        uint64_t   found = 0;
+
+        for (uint64_t n = 0; n < probes; ++n)
+            found += lookup(keys[n % keys.size()]) != nullptr;
+
+        const double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+        std::cerr << std::setw(12) << std::fixed << std::setprecision(2)
+                  << ns / std::max<uint64_t>(probes, 1) << std::setw(12) << found << std::endl;
+    };
+
+    std::cerr << "\nLookup        Probe (ns)       Found" << std::endl;
+
+    std::cerr << "Table       ";
+    measure([](Key key) { return probe<Value>(key); });
+
+    std::cerr << "Hash map    ";
+    measure([&](Key key) {
+        auto it = map.find(key);
+        return it != map.end() ? it->second : nullptr;
+    });
 }
 }
 
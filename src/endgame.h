@@ -19,11 +19,9 @@
 #ifndef ENDGAME_H_INCLUDED
 #define ENDGAME_H_INCLUDED
 
-#include <memory>
+#include <cstdint>
 #include <string>
 #include <type_traits>
-#include <unordered_map>
-#include <utility>
 
 #include "position.h"
 #include "types.h"
@@ -67,18 +65,23 @@ template<EndgameCode E>
 using eg_type = typename std::conditional<(E < SCALING_FUNCTIONS), Value, ScaleFactor>::type;
 
 
-/// Base and derived functors for endgame evaluation and scaling functions
+/// Base and derived functors for endgame evaluation and scaling functions. The base
+/// holds a pointer to the function of the derived functor, which is called directly
+/// rather than through a virtual operator().
 
 template<typename T>
 struct EndgameBase {
 
-    explicit EndgameBase(Color c) :
+    using Function = T (*)(const EndgameBase&, const Position&);
+
+    EndgameBase(Color c, Function f) :
         strongSide(c),
-        weakSide(~c) {}
-    virtual ~EndgameBase()                      = default;
-    virtual T operator()(const Position&) const = 0;
+        weakSide(~c),
+        function(f) {}
+    T operator()(const Position& pos) const { return function(*this, pos); }
 
-    const Color strongSide, weakSide;
+    const Color    strongSide, weakSide;
+    const Function function;
 };
 
 
@@ -86,43 +89,65 @@ template<EndgameCode E, typename T = eg_type<E>>
 struct Endgame: public EndgameBase<T> {
 
     explicit Endgame(Color c) :
-        EndgameBase<T>(c) {}
-    T operator()(const Position&) const override;
+        EndgameBase<T>(c, &call) {}
+    T operator()(const Position&) const;
+
+   private:
+    static T call(const EndgameBase<T>& eg, const Position& pos) {
+        return static_cast<const Endgame&>(eg)(pos);
+    }
 };
 
 
-/// The Endgames namespace handles the pointers to endgame evaluation and scaling
-/// base objects in two std::map. We use polymorphism to invoke the actual
-/// endgame function by calling its virtual operator().
+/// The Endgames namespace registers the endgame evaluation and scaling functions by
+/// the material key of their configurations, in a flat table of TableSize slots. The
+/// slot of a key is given by a multiplicative hash, whose multiplier is chosen by
+/// init() so that it is perfect for the registered keys: a probe reads a single slot.
+/// The functors are static objects, one for each strong side.
 
 namespace Endgames {
 
-template<typename T>
-using Ptr = std::unique_ptr<EndgameBase<T>>;
-template<typename T>
-using Map = std::unordered_map<Key, Ptr<T>>;
+constexpr int TableBits = 8;
+constexpr int TableSize = 1 << TableBits;
+
+struct Slot {
+    Key                             key;
+    const EndgameBase<Value>*       evaluation;
+    const EndgameBase<ScaleFactor>* scaling;
+};
 
-extern std::pair<Map<Value>, Map<ScaleFactor>> maps;
+extern Slot     table[TableSize];
+extern uint64_t multiplier;
 
 void init();
+void benchmark(uint64_t probes);
+void insert(Key key, const EndgameBase<Value>* eg);
+void insert(Key key, const EndgameBase<ScaleFactor>* eg);
 
-template<typename T>
-Map<T>& map() {
-    return std::get<std::is_same<T, ScaleFactor>::value>(maps);
-}
+inline size_t index(Key key) { return size_t((key * multiplier) >> (64 - TableBits)); }
 
 template<EndgameCode E, typename T = eg_type<E>>
 void add(const std::string& code) {
 
+    static const Endgame<E> endgames[COLOR_NB] = {Endgame<E>(WHITE), Endgame<E>(BLACK)};
+
     StateInfo st;
-    map<T>()[Position().set(code, WHITE, &st).material_key()] = Ptr<T>(new Endgame<E>(WHITE));
-    map<T>()[Position().set(code, BLACK, &st).material_key()] = Ptr<T>(new Endgame<E>(BLACK));
+    insert(Position().set(code, WHITE, &st).material_key(), &endgames[WHITE]);
+    insert(Position().set(code, BLACK, &st).material_key(), &endgames[BLACK]);
 }
 
 template<typename T>
 const EndgameBase<T>* probe(Key key) {
-    auto it = map<T>().find(key);
-    return it != map<T>().end() ? it->second.get() : nullptr;
+
+    const Slot& slot = table[index(key)];
+
+    if (slot.key != key)
+        return nullptr;
+
+    if constexpr (std::is_same_v<T, ScaleFactor>)
+        return slot.scaling;
+    else
+        return slot.evaluation;
 }
 }
 
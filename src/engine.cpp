@@ -20,9 +20,11 @@
 
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <deque>
 #include <iosfwd>
 #include <memory>
+#include <numeric>
 #include <ostream>
 #include <sstream>
 #include <string_view>
@@ -98,6 +100,34 @@ Engine::Engine(std::optional<std::string> path) :
           return std::nullopt;
       }));
 
+    options.add(  //
+      "Hash NUMA Placement",
+      Option("Default var Default var Interleave var Partition", "Default", [this](const Option&) {
+          set_tt_size(options["Hash"]);
+          return std::nullopt;
+      }));
+
+    options.add(  //
+      "Shared Hash", Option("", [this](const Option& o) -> std::optional<std::string> {
+          set_tt_size(options["Hash"]);
+          if (std::string(o).empty())
+              return std::nullopt;
+          return tt.is_shared() ? "Hash shared as " + std::string(o)
+                                : "Unable to share the hash, using a private one";
+      }));
+
+    options.add(  //
+      "Eval Cache", Option(0, 0, 1024, [this](const Option& o) {
+          set_eval_cache_size(o);
+          return std::nullopt;
+      }));
+
+    options.add(  //
+      "Pawn Hash", Option(16, 1, 1024, [this](const Option& o) {
+          set_pawn_hash_size(o);
+          return std::nullopt;
+      }));
+
     options.add("Ponder", Option(false));
 
     options.add("MultiPV", Option(1, 1, MAX_MOVES));
@@ -214,6 +244,8 @@ Engine::Engine(std::optional<std::string> path) :
 
     options.add("Experience Book Min Depth", Option(4, 1, 255));
 
+    options.add("Experience TT Seeding Plies", Option(0, 0, 64));
+
     // From MCTS
     options.add("MCTS by Shashin", Option(false));
 
@@ -225,6 +257,10 @@ Engine::Engine(std::optional<std::string> path) :
 
     options.add("MCTS Explore", Option(false));
 
+    options.add("MCTS Hash", Option(128, 1, 32768));
+
+    options.add("MCTS Virtual Loss", Option(1, 0, 100));
+
     // LiveBook options
 #ifdef USE_LIVEBOOK
     options.add("LiveBook Proxy Url", Option("", [](const Option& o) -> std::optional<std::string> {
@@ -292,6 +328,11 @@ Engine::Engine(std::optional<std::string> path) :
 
     options.add("Concurrent Experience", Option(false));
 
+    options.add("Shared Experience", Option(false, [this](const Option&) {
+                    LD.init(get_options());
+                    return std::nullopt;
+                }));
+
     // Shashin personalities begin
     options.add("High Tal",
                 Option(false, [this](const Option&) noexcept -> std::optional<std::string> {
@@ -345,11 +386,17 @@ void Engine::go(Search::LimitsType& limits) {
 }
 void Engine::stop() { threads.stop = true; }
 
-void Engine::search_clear() {
+// Without waiting for the hash, it is invalidated at once and zeroed in the background
+void Engine::search_clear(bool waitForHash) {
     wait_for_search_finished();
 
     MCTS.clear();  //mcts
-    tt.clear(threads);
+
+    if (waitForHash)
+        tt.clear(threads);
+    else
+        tt.clear_in_background(threads);
+
     threads.clear();
 
     // @TODO wont work with multiple instances
@@ -441,7 +488,8 @@ void Engine::resize_threads() {
     shCfg.highPetrosian   = options["High Petrosian"];
     shCfg.middlePetrosian = options["Middle Petrosian"];
     shCfg.lowPetrosian    = options["Low Petrosian"];
-    threads.set(numaContext.get_numa_config(), {bookMan, options, threads, tt, sharedHists, shCfg},
+    threads.set(numaContext.get_numa_config(),
+                {bookMan, options, threads, tt, sharedHists, evalCaches, pawnsTables, shCfg},
                 updateContext);  //book management from classical
 
     //from shashin end
@@ -452,9 +500,56 @@ void Engine::resize_threads() {
 void Engine::init_bookMan(int bookIndex) { bookMan.init(bookIndex, options); }  //book management
 void Engine::resize_full(size_t requested) { threads.setFull(requested); }      //full threads patch
 
+// Runs the function for each NUMA node of the threads, on a thread of the node, so
+// that the memory it allocates is on the node
+void Engine::run_on_numa_nodes(const std::function<void(NumaIndex)>& f) {
+    wait_for_search_finished();
+
+    std::vector<NumaIndex> visited;
+
+    for (size_t i = 0; i < threads.num_threads(); ++i)
+    {
+        const NumaIndex numaIndex = threads.get_bound_numa_node(i);
+
+        if (std::find(visited.begin(), visited.end(), numaIndex) != visited.end())
+            continue;
+
+        visited.push_back(numaIndex);
+        threads.run_on_thread(i, [&f, numaIndex]() { f(numaIndex); });
+    }
+
+    for (size_t i = 0; i < threads.num_threads(); ++i)
+        threads.wait_on_thread(i);
+}
+
+void Engine::set_eval_cache_size(size_t mb) {
+    run_on_numa_nodes([this, mb](NumaIndex numaIndex) { evalCaches.at(numaIndex).resize(mb); });
+}
+
+void Engine::set_pawn_hash_size(size_t mb) {
+    run_on_numa_nodes([this, mb](NumaIndex numaIndex) { pawnsTables.at(numaIndex).resize(mb); });
+}
+
 void Engine::set_tt_size(size_t mb) {
     wait_for_search_finished();
-    tt.resize(mb, threads);
+
+    const std::string placement = options["Hash NUMA Placement"];
+
+    tt.resize(mb, threads,
+              placement == "Interleave"  ? TTPlacement::Interleave
+              : placement == "Partition" ? TTPlacement::Partition
+                                         : TTPlacement::Default,
+              options["Shared Hash"]);
+}
+
+bool Engine::save_tt(const std::string& fileName) {
+    wait_for_search_finished();
+    return tt.save(fileName);
+}
+
+bool Engine::load_tt(const std::string& fileName) {
+    wait_for_search_finished();
+    return tt.load(fileName);
 }
 
 void Engine::set_ponderhit(bool b) { threads.main_manager()->ponder = b; }
@@ -480,6 +575,11 @@ void Engine::flip() { pos.flip(); }
 void Engine::show_moves_bookMan(const Position& position) {
     bookMan.show_moves(position, options);
 }  //book management
+//learning
+bool Engine::maintain_experience(const ExperienceMaintenance& tasks) {
+    wait_for_search_finished();
+    return LD.maintain(tasks, options, threads);
+}
 std::string Engine::visualize() const {
     std::stringstream ss;
     ss << pos;
@@ -488,6 +588,56 @@ std::string Engine::visualize() const {
 
 int Engine::get_hashfull(int maxAge) const { return tt.hashfull(maxAge); }
 
+// Returns the number of probes of the evaluation caches and of their hits
+std::pair<uint64_t, uint64_t> Engine::eval_cache_stats() const {
+    uint64_t probes = 0, hits = 0;
+
+    for (auto it = threads.cbegin(); it != threads.cend(); ++it)
+    {
+        probes += (*it)->worker->evalCacheProbes;
+        hits += (*it)->worker->evalCacheHits;
+    }
+
+    return {probes, hits};
+}
+
+// Measures the average latency of a transposition table probe in nanoseconds, with
+// all the threads probing random keys at once. Each key depends on the previous probe,
+// so that the probes of a thread don't overlap.
+double Engine::tt_probe_latency(size_t probesPerThread) {
+    wait_for_search_finished();
+
+    const size_t        threadCount = threads.num_threads();
+    std::vector<double> nanos(threadCount);
+    std::vector<Key>    keys(threadCount);
+
+    for (size_t i = 0; i < threadCount; ++i)
+        threads.run_on_thread(i, [&, i]() {
+            PRNG rng(1070372 + i);
+            Key  key = rng.rand<Key>();
+
+            const auto start = std::chrono::steady_clock::now();
+
+            for (size_t j = 0; j < probesPerThread; ++j)
+            {
+                const auto [ttHit, ttData, ttWriter] = tt.probe(key);
+                key = (key ^ Key(ttData.depth) ^ ttData.move.raw()) * 6364136223846793005ULL
+                    + 1442695040888963407ULL;
+            }
+
+            const std::chrono::duration<double, std::nano> elapsed =
+              std::chrono::steady_clock::now() - start;
+
+            nanos[i] = elapsed.count() / double(std::max<size_t>(probesPerThread, 1));
+            keys[i]  = key;  // Keep the probes from being optimized out
+        });
+
+    for (size_t i = 0; i < threadCount; ++i)
+        threads.wait_on_thread(i);
+
+    return std::accumulate(nanos.begin(), nanos.end(), 0.0) / double(threadCount);
+}
+
 std::vector<std::pair<size_t, size_t>> Engine::get_bound_thread_count_by_numa_node() const {
     auto                                   counts = threads.get_bound_thread_count_by_numa_node();
     const NumaConfig&                      cfg    = numaContext.get_numa_config();
@@ -38,6 +38,8 @@
 #include "tt.h"
 #include "ucioption.h"
 
+struct ExperienceMaintenance;  //learning
+
 namespace Alexander {
 
 class Engine {
@@ -76,8 +78,12 @@ class Engine {
     void init_bookMan(int bookIndex);    //book management
     void resize_full(size_t requested);  //full threads patch
     void set_tt_size(size_t mb);
+    void set_eval_cache_size(size_t mb);
+    void set_pawn_hash_size(size_t mb);
+    bool save_tt(const std::string& fileName);
+    bool load_tt(const std::string& fileName);
     void set_ponderhit(bool);
-    void search_clear();
+    void search_clear(bool waitForHash = true);
 #ifdef USE_LIVEBOOK
     void setLiveBookURL(const std::string& newURL);
     void setLiveBookTimeout(size_t newTimeoutMS);
@@ -97,11 +103,15 @@ class Engine {
     OptionsMap&       get_options();
     BookManager       get_bookMan();  //book management
     int               get_hashfull(int maxAge = 0) const;
+    double            tt_probe_latency(size_t probesPerThread);
+
+    std::pair<uint64_t, uint64_t> eval_cache_stats() const;
 
     std::string fen() const;
     void        flip();
     std::string visualize() const;
     void        show_moves_bookMan(const Position& position);  //book management
+    bool        maintain_experience(const ExperienceMaintenance& tasks);  //learning
     std::vector<std::pair<size_t, size_t>> get_bound_thread_count_by_numa_node() const;
     std::string                            get_numa_config_as_string() const;
     std::string                            numa_config_information_as_string() const;
@@ -109,6 +119,8 @@ class Engine {
     std::string                            thread_binding_information_as_string() const;
     Position                               pos;  //from learning
    private:
+    void run_on_numa_nodes(const std::function<void(NumaIndex)>& f);
+
     const std::string binaryDirectory;
 
     NumaReplicationContext numaContext;
@@ -122,6 +134,8 @@ class Engine {
     BookManager                          bookMan;  //book management
     Search::SearchManager::UpdateContext updateContext;
     std::map<NumaIndex, SharedHistories> sharedHists;
+    std::map<NumaIndex, Eval::Cache>     evalCaches;
+    std::map<NumaIndex, Pawns::Table>    pawnsTables;
     //for classical
 };
 
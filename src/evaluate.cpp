@@ -30,6 +30,9 @@
 #include "pawns.h"
 #include "bitboard.h"
 #include "material.h"
+#include "memory.h"
+#include "search.h"
+#include "thread.h"
 #include <cstring>  // For std::memset
 #include <string>
 #include "handicap/trace/trace.h"
@@ -128,6 +131,7 @@ class Evaluation {
         pos(p) {}
     Evaluation& operator=(const Evaluation&) = delete;
     Value       value();
+    bool        is_lazy() const { return lazy; }
 
    private:
     template<Color Us>
@@ -149,6 +153,10 @@ class Evaluation {
     Bitboard          mobilityArea[COLOR_NB];
     ScoreForClassical mobility[COLOR_NB] = {SCORE_ZERO, SCORE_ZERO};
 
+    // lazy is set when the evaluation exits early, with a value depending on the
+    // best value of the search of the thread
+    bool lazy = false;
+
     // attackedBy[color][piece type] is a bitboard representing all squares
     // attacked by a given color and piece type. Special "piece types" which
     // is also calculated is ALL_PIECES.
@@ -256,10 +264,7 @@ ScoreForClassical Evaluation<T>::pieces() {
         Square s = pop_lsb(b1);
 
         // Find attacked squares, including x-ray attacks for bishops and rooks
-        b = Pt == BISHOP ? attacks_bb<BISHOP>(s, pos.pieces() ^ pos.pieces(QUEEN))
-          : Pt == ROOK
-            ? attacks_bb<ROOK>(s, pos.pieces() ^ pos.pieces(QUEEN) ^ pos.pieces(Us, ROOK))
-            : attacks_bb<Pt>(s, pos.pieces());
+        b = pos.piece_attacks(s);
 
         if (pos.blockers_for_king(Us) & s)
             b &= line_bb(pos.square<KING>(Us), s);
@@ -864,7 +869,7 @@ Value Evaluation<T>::value() {
                  + pos.non_pawn_material() / 32;
     };
 
-    if (lazy_skip(LazyThreshold1))
+    if ((lazy = lazy_skip(LazyThreshold1)))
         goto make_v;
 
     // Main evaluation begins here
@@ -922,7 +927,7 @@ Value Evaluation<T>::value() {
     }
 
     //from handicap mode end
-    if (lazy_skip(LazyThreshold2))
+    if ((lazy = lazy_skip(LazyThreshold2)))
         goto make_v;
 
     {
@@ -962,6 +967,40 @@ make_v:
 }
 }
 namespace Eval {
+Cache::~Cache() { aligned_large_pages_free(table); }
+
+// Resizes the cache to the largest power of two of entries fitting in mbSize
+// megabytes, 0 disabling it. The calling thread zeroes it, so that its pages are
+// allocated on the NUMA node of the thread.
+void Cache::resize(size_t mbSize) {
+    aligned_large_pages_free(table);
+    table = nullptr;
+    count = 0;
+
+    if (!mbSize)
+        return;
+
+    const size_t entries = size_t(1) << msb(mbSize * 1024 * 1024 / sizeof(std::atomic<uint64_t>));
+    table                = static_cast<std::atomic<uint64_t>*>(
+      aligned_large_pages_alloc(entries * sizeof(std::atomic<uint64_t>)));
+
+    if (!table)
+        return;
+
+    count = entries;
+    clear_range(0, 1);
+}
+
+// Each thread of the NUMA node zeroes its part of the cache
+void Cache::clear_range(size_t threadIdx, size_t threadCount) {
+    const size_t stride = count / threadCount;
+    const size_t start  = stride * threadIdx;
+    const size_t len    = threadIdx + 1 != threadCount ? stride : count - start;
+
+    for (size_t i = start; i < start + len; ++i)
+        table[i].store(0, std::memory_order_relaxed);
+}
+
 Value evaluate_position(const Position& pos) {
     assert(!pos.checkers());
     return Evaluation<NO_TRACE>(pos).value();
@@ -970,8 +1009,24 @@ Value evaluate(const Position& pos) {
 
     assert(!pos.checkers());
 
-    // Evaluate the position without trace
-    Value v = Evaluation<NO_TRACE>(pos).value();
+    // Evaluate the position without trace, unless its evaluation is cached. The
+    // lazy evaluations depend on the search, and are not cached.
+    Search::Worker& worker = *pos.this_thread()->worker;
+    const Key       key    = pos.key() ^ handicapConfig.evalKey;
+    Value           v;
+
+    ++worker.evalCacheProbes;
+
+    if (worker.evalCache.probe(key, v))
+        ++worker.evalCacheHits;
+    else
+    {
+        Evaluation<NO_TRACE> eval(pos);
+        v = eval.value();
+
+        if (!eval.is_lazy())
+            worker.evalCache.store(key, v);
+    }
 
     // Damp down the evaluation linearly when shuffling (rule50 count)
     int shuffling = pos.rule50_count();
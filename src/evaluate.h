@@ -19,7 +19,12 @@
 #ifndef EVALUATE_H_INCLUDED
 #define EVALUATE_H_INCLUDED
 
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
 #include "handicap/evaluate_handicap.h"
+#include "types.h"
 namespace Alexander {
 
 class Position;
@@ -29,6 +34,41 @@ namespace Eval {
 std::string trace(Position& pos);  //for classical
 Value       evaluate(const Position& pos);
 Value       evaluate_position(const Position& pos); //for trace
+
+// A lockless cache of the classical evaluations, shared by the threads of a NUMA node
+// and allocated on its memory. An entry is a single word, holding the upper 48 bits
+// of the key and the value, so that it is written and read at once.
+class Cache {
+   public:
+    Cache() = default;
+    ~Cache();
+    Cache(const Cache&)            = delete;
+    Cache& operator=(const Cache&) = delete;
+
+    void resize(size_t mbSize);
+    void clear_range(size_t threadIdx, size_t threadCount);
+
+    bool probe(Key key, Value& v) const {
+        if (!count)
+            return false;
+
+        const uint64_t data = table[key & (count - 1)].load(std::memory_order_relaxed);
+        v                   = Value(int16_t(data));
+        return data && !((data ^ key) >> 16);
+    }
+
+    const void* entry(Key key) const { return count ? &table[key & (count - 1)] : nullptr; }
+
+    void store(Key key, Value v) {
+        if (count)
+            table[key & (count - 1)].store((key & ~uint64_t(0xFFFF)) | uint16_t(v),
+                                           std::memory_order_relaxed);
+    }
+
+   private:
+    std::atomic<uint64_t>* table = nullptr;
+    size_t                 count = 0;
+};
 }  // namespace Eval
 
 }  // namespace Alexander
@@ -81,7 +81,7 @@ constexpr std::array<uint8_t, 12> maxWinProbabilities = {
 uint8_t get_handicap_max_win_probability(uint8_t wp) {
     auto it = std::lower_bound(maxWinProbabilities.begin(), maxWinProbabilities.end(), wp,
                                std::greater<>());
-    return (it != maxWinProbabilities.end() - 1) ? *(it + 1)
+    return (it < maxWinProbabilities.end() - 1) ? *(it + 1)
                                                  : static_cast<uint8_t>(HIGH_PETROSIAN_MAX);
 }
 
@@ -373,6 +373,7 @@ void initHandicapMode(const OptionsMap& options) {
     handicapConfig.simulateHumanBlunders =
       handicapConfig.limitStrength ? (bool) options["Simulate human blunders"] : false;
     handicapConfig.handicappedDepth = options["Handicapped Depth"];
+    handicapConfig.evalKey += 0x9E3779B97F4A7C15ULL;
     initHandicapMinMaxValueThresholds();
     //true handicap mode end
 }
@@ -447,6 +448,7 @@ void loadAvatar(const std::string& fname) {
         if ((it = weightsProperties.find(Weights[i].egName)) != weightsProperties.end())
             Weights[i].eg = it->second;
     }
+    handicapConfig.evalKey += 0x9E3779B97F4A7C15ULL;
 }
 
 }  // namespace Eval
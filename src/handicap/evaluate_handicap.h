@@ -126,6 +126,7 @@ struct HandicapConfig {
     bool simulateHumanBlunders;
     bool handicappedDepth;
     int  uciElo;
+    Key  evalKey;  // Changed with the evaluation, so that the cached evaluations are missed
     HandicapConfig() :
         limitStrength(false),
         pawnsToEvaluate(true),
@@ -133,7 +134,8 @@ struct HandicapConfig {
         imbalancesToEvaluate(true),
         simulateHumanBlunders(false),
         handicappedDepth(false),
-        uciElo(MAX_ELO) {}
+        uciElo(MAX_ELO),
+        evalKey(0) {}
 };
 
 // Variabile globale per configurare la modalità handicap
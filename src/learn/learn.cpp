@@ -5,6 +5,11 @@
 #include "learn.h"
 #include <algorithm>
 #include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <numeric>
+#include <queue>
+#include "../thread.h"
 #include "../uci.h"
 
 using namespace std;
@@ -12,6 +17,12 @@ using namespace Alexander;
 
 LearningData LD;
 
+//An entry of the block index of a sorted experience file
+struct ExperienceBlock {
+    Key      firstKey;
+    uint64_t offset;
+};
+
 namespace {
 LearningMode identify_learning_mode(const string& lm) {
     if (lm == "Off")
@@ -22,87 +33,682 @@ LearningMode identify_learning_mode(const string& lm) {
 
     return LearningMode::Self;
 }
+
+//The header record of a sorted experience file. It is never probed: no position
+//has a zero key, and the moves of depth 0 are not persisted. Version 1 files are
+//arrays of records, converted at the first load.
+constexpr Value SortedExperienceSignature = 0x53584C41;  //"ALXS"
+constexpr int   SortedExperienceVersion   = 2;
+
+PersistedLearningMove experience_header() {
+    PersistedLearningMove header;
+    header.key                      = 0;
+    header.learningMove.depth       = 0;
+    header.learningMove.score       = SortedExperienceSignature;
+    header.learningMove.move        = Move::none();
+    header.learningMove.performance = SortedExperienceVersion;
+
+    return header;
 }
 
-bool LearningData::load(const string& filename) {
-    ifstream in(filename, ios::in | ios::binary);
+bool is_experience_header(const PersistedLearningMove& plm) {
+    return plm.key == 0 && plm.learningMove.depth == 0
+        && plm.learningMove.score == SortedExperienceSignature;
+}
 
-    //Quick exit if file is not present
+//The journal is a sequence of batches, each one ending with a commit record whose
+//performance is the number of moves of the batch. The moves of a key are contiguous
+//in a batch, and replace all the previous moves of this key.
+constexpr Value JournalCommitSignature = 0x4A584C41;  //"ALXJ"
+
+constexpr const char* JournalFile           = "experience.journal";
+constexpr const char* CompactingJournalFile = "experience_compacting.journal";
+
+PersistedLearningMove journal_commit(int count) {
+    PersistedLearningMove commit;
+    commit.key                      = 0;
+    commit.learningMove.depth       = 0;
+    commit.learningMove.score       = JournalCommitSignature;
+    commit.learningMove.move        = Move::none();
+    commit.learningMove.performance = count;
+
+    return commit;
+}
+
+bool is_journal_commit(const PersistedLearningMove& plm) {
+    return plm.key == 0 && plm.learningMove.depth == 0
+        && plm.learningMove.score == JournalCommitSignature;
+}
+
+bool file_exists(const string& filename) { return ifstream(filename).is_open(); }
+
+//Reads a whole file in a buffer allocated with malloc(). Returns nullptr if the
+//file is missing, empty or cannot be read.
+void* read_file(const string& filename, size_t& fileSize) {
+    fileSize = 0;
+
+    ifstream in(filename, ios::in | ios::binary | ios::ate);
     if (!in.is_open())
+        return nullptr;
+
+    fileSize = in.tellg();
+    if (!fileSize)
+        return nullptr;
+
+    void* fileData = malloc(fileSize);
+    if (!fileData)
+    {
+        cerr << "info string Failed to allocate <" << fileSize << "> bytes to read file <"
+             << filename << ">" << endl;
+        return nullptr;
+    }
+
+    in.seekg(0, ios::beg);
+    in.read(static_cast<char*>(fileData), static_cast<std::streamsize>(fileSize));
+    if (!in)
+    {
+        free(fileData);
+
+        cerr << "info string Failed to read <" << fileSize << "> bytes from file <" << filename
+             << ">" << endl;
+        return nullptr;
+    }
+
+    return fileData;
+}
+
+//A sorted experience file starts with this header, followed by blocks of BlockKeys
+//keys in order. A block starts with the size in bytes of the differences between
+//its keys. Each key follows, as its difference with the previous key (none for the
+//first key of the block), then the number of its moves and the moves, stored in
+//EncodedMoveSize bytes each. The block index at the end of the file gives the first
+//key and the offset from the end of the header of each block, so that a key is
+//found by a search in the index and a short scan of its block.
+struct ExperienceFileHeader {
+    PersistedLearningMove signature;
+    uint64_t              keyCount;
+    uint64_t              moveCount;
+    uint64_t              blockCount;
+    uint64_t              indexOffset;
+};
+
+static_assert(sizeof(ExperienceFileHeader) % alignof(ExperienceBlock) == 0);
+
+constexpr size_t BlockKeys       = 16;
+constexpr size_t EncodedMoveSize = 6;
+constexpr size_t MaxKeyMoves     = 255;
+
+//The differences between keys are stored in little-endian order, in the fewest bytes
+//needed by the largest one of the block
+void put_difference(vector<uint8_t>& out, uint64_t value, int width) {
+    for (int i = 0; i < width; ++i, value >>= 8)
+        out.push_back(uint8_t(value));
+}
+
+uint64_t get_difference(const uint8_t*& p, int width) {
+    uint64_t value = 0;
+    for (int i = 0; i < width; ++i)
+        value |= uint64_t(*p++) << (8 * i);
+
+    return value;
+}
+
+//A move is stored as its 16 bits, the score as a 16-bit integer, and the depth and
+//the performance as bytes, all of them in little-endian order
+void encode_move(uint8_t* p, const LearningMove& learningMove) {
+    const uint16_t move  = learningMove.move.raw();
+    const uint16_t score = uint16_t(int16_t(std::clamp(int(learningMove.score), -32768, 32767)));
+
+    p[0] = uint8_t(move);
+    p[1] = uint8_t(move >> 8);
+    p[2] = uint8_t(score);
+    p[3] = uint8_t(score >> 8);
+    p[4] = uint8_t(std::clamp(int(learningMove.depth), 0, 255));
+    p[5] = uint8_t(std::clamp(learningMove.performance, 0, 255));
+}
+
+LearningMove decode_move(const uint8_t* p) {
+    LearningMove learningMove;
+    learningMove.move        = Move(uint16_t(p[0] | p[1] << 8));
+    learningMove.score       = Value(int16_t(uint16_t(p[2] | p[3] << 8)));
+    learningMove.depth       = Depth(p[4]);
+    learningMove.performance = p[5];
+
+    return learningMove;
+}
+
+//Checks the header and the block index of a sorted experience file
+bool parse_sorted(const unsigned char* data, size_t size, SortedExperience& sorted) {
+    ExperienceFileHeader header;
+    if (size < sizeof(header))
         return false;
 
-    //Get experience file size
-    in.seekg(0, ios::end);
-    const size_t fileSize = in.tellg();
+    memcpy(&header, data, sizeof(header));
+    if (!is_experience_header(header.signature)
+        || header.signature.learningMove.performance != SortedExperienceVersion
+        || header.blockCount != (header.keyCount + BlockKeys - 1) / BlockKeys
+        || header.indexOffset < sizeof(header) || header.indexOffset % alignof(ExperienceBlock)
+        || header.indexOffset > size
+        || (size - header.indexOffset) / sizeof(ExperienceBlock) != header.blockCount
+        || (size - header.indexOffset) % sizeof(ExperienceBlock))
+        return false;
+
+    sorted.blocks     = reinterpret_cast<const ExperienceBlock*>(data + header.indexOffset);
+    sorted.blockCount = header.blockCount;
+    sorted.data       = data + sizeof(header);
+    sorted.keyCount   = header.keyCount;
+    sorted.moveCount  = header.moveCount;
+
+    return true;
+}
+
+//Iterates the keys of a sorted experience file in order
+struct SortedCursor {
+    explicit SortedCursor(const SortedExperience& se, size_t firstBlock = 0) :
+        sorted(se),
+        index(firstBlock * BlockKeys) {}
+
+    bool next() {
+        if (index == sorted.keyCount)
+            return false;
+
+        if (index % BlockKeys == 0)
+        {
+            const ExperienceBlock& block = sorted.blocks[index / BlockKeys];
+
+            p     = sorted.data + block.offset;
+            width = *p++;
+            key   = block.firstKey;
+        }
+        else
+            key += get_difference(p, width);
+
+        count = *p++;
+        moves = p;
+        p += count * EncodedMoveSize;
+        ++index;
+
+        return true;
+    }
+
+    Key            key   = 0;
+    int            count = 0;
+    const uint8_t* moves = nullptr;
+
+   private:
+    const SortedExperience& sorted;
+    const uint8_t*          p     = nullptr;
+    int                     width = 0;
+    size_t                  index = 0;
+};
+
+//Returns the encoded moves of the given key, and their number. As the keys are
+//uniformly distributed, we interpolate the block of the key a few times before
+//finishing with a binary search.
+const uint8_t* find_sorted(const SortedExperience& sorted, Key key, int& count) {
+    const ExperienceBlock* lo = sorted.blocks;
+    const ExperienceBlock* hi = sorted.blocks + sorted.blockCount;
+
+    for (int i = 0; i < 4 && hi - lo > 64; ++i)
+    {
+        const Key first = lo->firstKey;
+        const Key last  = (hi - 1)->firstKey;
+
+        if (key < first || key >= last)
+            break;
+
+        const double fraction = double(key - first) / double(last - first);
+        const auto*  mid      = lo + ptrdiff_t(fraction * double(hi - 1 - lo));
+
+        if (mid->firstKey <= key)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    const ExperienceBlock* block = upper_bound(
+      lo, hi, key, [](Key k, const ExperienceBlock& b) { return k < b.firstKey; });
+
+    if (block == sorted.blocks)
+        return nullptr;
+
+    --block;
+
+    const size_t   first = size_t(block - sorted.blocks) * BlockKeys;
+    const size_t   keys  = min(BlockKeys, sorted.keyCount - first);
+    const uint8_t* p     = sorted.data + block->offset;
+    const int      width = *p++;
+    Key            k     = block->firstKey;
+
+    for (size_t i = 1;; ++i)
+    {
+        const int n = *p++;
+        if (k == key)
+        {
+            count = n;
+            return p;
+        }
+
+        if (k > key || i == keys)
+            return nullptr;
+
+        p += n * EncodedMoveSize;
+        k += get_difference(p, width);
+    }
+}
+
+//Reads an experience file of any format, drops its header and commit records, and
+//sorts it by key, in a buffer allocated with malloc(). The moves of a key are kept
+//in the order they were written, which is the order they were learned.
+PersistedLearningMove* read_run(const string& filename, size_t& count) {
+    count = 0;
+
+    size_t fileSize;
+    void*  fileData = read_file(filename, fileSize);
+    if (!fileData)
+        return nullptr;
+
+    SortedExperience sorted;
+    if (parse_sorted(static_cast<const unsigned char*>(fileData), fileSize, sorted))
+    {
+        auto* moves = static_cast<PersistedLearningMove*>(
+          malloc(max<size_t>(sorted.moveCount, 1) * sizeof(PersistedLearningMove)));
+
+        if (moves)
+            for (SortedCursor cursor(sorted); cursor.next();)
+                for (int i = 0; i < cursor.count && count < sorted.moveCount; ++i)
+                    moves[count++] = {cursor.key,
+                                      decode_move(cursor.moves + i * EncodedMoveSize)};
+        else
+            cerr << "info string Failed to allocate <" << sorted.moveCount
+                 << "> learning entries to read file <" << filename << ">" << endl;
+
+        free(fileData);
+        return moves;
+    }
 
     //File size should be a multiple of 'PersistedLearningMove'
     if (fileSize % sizeof(PersistedLearningMove))
     {
+        free(fileData);
+
         cerr << "info string The file <" << filename << "> with size <" << fileSize
              << "> is not a valid experience file" << endl;
-        return false;
+        return nullptr;
     }
 
-    //Allocate buffer to read the entire file
-    void* fileData = malloc(fileSize);
-    if (!fileData)
+    auto* moves = static_cast<PersistedLearningMove*>(fileData);
+    auto* last  = remove_if(moves, moves + fileSize / sizeof(PersistedLearningMove),
+                           [](const PersistedLearningMove& plm) {
+                               return is_experience_header(plm) || is_journal_commit(plm);
+                           });
+
+    auto byKey = [](const PersistedLearningMove& a, const PersistedLearningMove& b) {
+        return a.key < b.key;
+    };
+
+    if (!is_sorted(moves, last, byKey))
+        stable_sort(moves, last, byKey);
+
+    count = size_t(last - moves);
+    return moves;
+}
+
+//Writes a sorted experience file. The moves are added in the order of their keys,
+//and those of depth 0 are skipped.
+class ExperienceWriter {
+   public:
+    explicit ExperienceWriter(const string& fn) :
+        filename(fn),
+        out(fn, ofstream::trunc | ofstream::binary) {
+        ExperienceFileHeader header{};
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    }
+
+    void add(Key k, const LearningMove& learningMove) {
+        if (learningMove.depth == 0)
+            return;
+
+        if (!moves.empty() && k != key)
+            flush_key();
+
+        key = k;
+        if (moves.size() < MaxKeyMoves)
+            moves.push_back(learningMove);
+    }
+
+    bool close() {
+        if (!moves.empty())
+            flush_key();
+
+        if (!blockKeys.empty())
+            flush_block();
+
+        //The block index is aligned after the keys
+        while ((dataSize + buffer.size()) % alignof(ExperienceBlock))
+            buffer.push_back(0);
+
+        ExperienceFileHeader header;
+        header.signature   = experience_header();
+        header.keyCount    = keyCount;
+        header.moveCount   = moveCount;
+        header.blockCount  = index.size();
+        header.indexOffset = sizeof(header) + dataSize + buffer.size();
+
+        flush_buffer();
+        out.write(reinterpret_cast<const char*>(index.data()),
+                  static_cast<std::streamsize>(index.size() * sizeof(ExperienceBlock)));
+        out.seekp(0);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.close();
+
+        if (!out)
+        {
+            cerr << "info string Failed to write experience file <" << filename << ">" << endl;
+            remove(filename.c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+   private:
+    void flush_key() {
+        blockKeys.push_back(key);
+        blockCounts.push_back(uint8_t(moves.size()));
+        blockMoves.insert(blockMoves.end(), moves.begin(), moves.end());
+        moves.clear();
+
+        if (blockKeys.size() == BlockKeys)
+            flush_block();
+    }
+
+    void flush_block() {
+        uint64_t maxDifference = 0;
+        for (size_t i = 1; i < blockKeys.size(); ++i)
+            maxDifference = max(maxDifference, blockKeys[i] - blockKeys[i - 1]);
+
+        int width = 0;
+        while (width < 8 && (maxDifference >> (8 * width)))
+            ++width;
+
+        index.push_back({blockKeys[0], dataSize + buffer.size()});
+        buffer.push_back(uint8_t(width));
+
+        const LearningMove* learningMove = blockMoves.data();
+        for (size_t i = 0; i < blockKeys.size(); ++i)
+        {
+            if (i)
+                put_difference(buffer, blockKeys[i] - blockKeys[i - 1], width);
+
+            buffer.push_back(blockCounts[i]);
+            for (int j = 0; j < blockCounts[i]; ++j)
+            {
+                buffer.resize(buffer.size() + EncodedMoveSize);
+                encode_move(&buffer[buffer.size() - EncodedMoveSize], *learningMove++);
+            }
+        }
+
+        keyCount += blockKeys.size();
+        moveCount += blockMoves.size();
+        blockKeys.clear();
+        blockCounts.clear();
+        blockMoves.clear();
+
+        if (buffer.size() >= (1 << 20))
+            flush_buffer();
+    }
+
+    void flush_buffer() {
+        out.write(reinterpret_cast<const char*>(buffer.data()),
+                  static_cast<std::streamsize>(buffer.size()));
+        dataSize += buffer.size();
+        buffer.clear();
+    }
+
+    string                  filename;
+    ofstream                out;
+    vector<uint8_t>         buffer;
+    vector<ExperienceBlock> index;
+    vector<LearningMove>    moves;
+    vector<Key>             blockKeys;
+    vector<uint8_t>         blockCounts;
+    vector<LearningMove>    blockMoves;
+    Key                     key       = 0;
+    uint64_t                dataSize  = 0;
+    uint64_t                keyCount  = 0;
+    uint64_t                moveCount = 0;
+};
+
+//Calls the visitor for each move of the committed batches of a journal, telling it
+//whether the move is the first one of its key in the batch. Returns the number of
+//records up to the last commit: the following ones belong to an interrupted batch.
+template<typename Visitor>
+size_t replay_journal(PersistedLearningMove* records, size_t count, const Visitor& visitor) {
+    size_t batchStart = 0;
+    size_t committed  = 0;
+
+    for (size_t i = 0; i < count; ++i)
     {
-        cerr << "info string Failed to allocate <" << fileSize
-             << "> bytes to read experience file <" << filename << ">" << endl;
-        return false;
+        if (!is_journal_commit(records[i]))
+            continue;
+
+        //A torn batch followed by a complete one: only replay the latter
+        const size_t batchSize = size_t(records[i].learningMove.performance);
+        if (batchSize <= i - batchStart)
+            for (size_t j = i - batchSize; j < i; ++j)
+                visitor(records[j], j == i - batchSize || records[j].key != records[j - 1].key);
+
+        batchStart = committed = i + 1;
     }
 
-    //Read the entire file
-    in.seekg(0, ios::beg);  //Move read pointer to the beginning of the file
-    in.read(static_cast<char*>(fileData), static_cast<std::streamsize>(fileSize));
-    if (!in)
+    return committed;
+}
+
+//Writes a sorted experience file, merging the moves of a sorted file with those of
+//the given sorted keys, which replace the moves of the same key
+template<typename MovesOf>
+bool write_sorted_experience(const string&           filename,
+                             const SortedExperience& sorted,
+                             const vector<Key>&      keys,
+                             const MovesOf&          movesOf) {
+    ExperienceWriter writer(filename);
+    SortedCursor     cursor(sorted);
+
+    auto copy = [&] {
+        for (int i = 0; i < cursor.count; ++i)
+            writer.add(cursor.key, decode_move(cursor.moves + i * EncodedMoveSize));
+
+        return cursor.next();
+    };
+
+    bool more = cursor.next();
+    for (const Key key : keys)
     {
-        free(fileData);
+        while (more && cursor.key < key)
+            more = copy();
 
-        cerr << "info string Failed to read <" << fileSize << "> bytes from experience file <"
-             << filename << ">" << endl;
-        return false;
+        if (more && cursor.key == key)
+            more = cursor.next();
+
+        movesOf(key, [&](const LearningMove& learningMove) { writer.add(key, learningMove); });
     }
 
-    //Close the input data file
-    in.close();
+    while (more)
+        more = copy();
 
-    //Save pointer to fileData to be freed later
-    mainDataBuffers.push_back(fileData);
+    return writer.close();
+}
+
+//Merges a sorted experience file with a journal in a new sorted file. This runs in
+//the background, and only reads the mapped file and the journal.
+bool compact_experience(const SortedExperience& sorted,
+                        const string&           journalFilename,
+                        const string&           filename) {
+    unordered_map<Key, vector<LearningMove>> journal;
+
+    size_t fileSize;
+    if (void* fileData = read_file(journalFilename, fileSize))
+    {
+        replay_journal(static_cast<PersistedLearningMove*>(fileData),
+                       fileSize / sizeof(PersistedLearningMove),
+                       [&](const PersistedLearningMove& plm, bool firstOfKey) {
+                           vector<LearningMove>& moves = journal[plm.key];
+                           if (firstOfKey)
+                               moves.clear();
+
+                           moves.push_back(plm.learningMove);
+                       });
+        free(fileData);
+    }
+
+    vector<Key> keys;
+    keys.reserve(journal.size());
+    for (const auto& kvp : journal)
+        keys.push_back(kvp.first);
+
+    sort(keys.begin(), keys.end());
+
+    return write_sorted_experience(filename, sorted, keys, [&](Key key, const auto& write) {
+        for (const LearningMove& learningMove : journal[key])
+            write(learningMove);
+    });
+}
+}
+
+bool LearningData::load(const string& filename) {
+    size_t count;
+    auto*  moves = read_run(filename, count);
+
+    //Quick exit if file is not present
+    if (!moves)
+        return false;
+
+    //Save pointer to moves to be freed later
+    mainDataBuffers.push_back(moves);
 
     //Loop the moves from this file
-    const bool qLearning             = learningMode == LearningMode::Self;
-    auto*      persistedLearningMove = static_cast<PersistedLearningMove*>(fileData);
-    do
+    const bool qLearning = learningMode == LearningMode::Self;
+    for (size_t i = 0; i < count; ++i)
+        insert_or_update(&moves[i], qLearning);
+
+    return true;
+}
+
+bool LearningData::map_sorted(const string& filename) {
+    unmap_sorted();
+
+    if (!sortedFile.map(filename, false))
+        return false;
+
+    //Only sorted experience files of the current version can be probed in place
+    if (!parse_sorted(sortedFile.data(), sortedFile.data_size(), sorted))
     {
-        insert_or_update(persistedLearningMove, qLearning);
-        ++persistedLearningMove;
-    } while (reinterpret_cast<size_t>(persistedLearningMove)
-             < reinterpret_cast<size_t>(fileData) + fileSize);
+        unmap_sorted();
+        return false;
+    }
 
     return true;
 }
 
-inline bool should_update(const LearningMove existing_move, const LearningMove learning_move) {
-    if (learning_move.depth > existing_move.depth)
+void LearningData::unmap_sorted() {
+    sortedFile.unmap();
+    sorted = SortedExperience();
+}
+
+//Copies the moves of the sorted file with the given key to the delta, unless the
+//delta already holds this key
+void LearningData::materialize(Key key) {
+    if (HT.find(key) != HT.end())
+        return;
+
+    int            count;
+    const uint8_t* encoded = find_sorted(sorted, key, count);
+    if (!encoded)
+        return;
+
+    const size_t bytes = count * sizeof(PersistedLearningMove);
+
+    auto* moves = static_cast<PersistedLearningMove*>(malloc(bytes));
+    if (!moves)
     {
-        return true;
+        cerr << "info string Failed to allocate <" << bytes << "> bytes for learning entries"
+             << endl;
+        return;
     }
 
-    if (learning_move.depth < existing_move.depth)
+    //Save pointer to moves to be freed later
+    newMovesDataBuffers.push_back(moves);
+
+    for (int i = 0; i < count; ++i)
     {
-        return false;
+        moves[i] = {key, decode_move(encoded + i * EncodedMoveSize)};
+        HT.insert({key, &moves[i].learningMove});
     }
+}
 
-    if (learning_move.score != existing_move.score)
+//Calls the visitor for each move of the given key, merged with the moves learned by
+//the other engines in the shared table
+template<typename Visitor>
+void LearningData::visit(Key key, const Visitor& visitor) const {
+    //The moves of the shared table replace the same moves when they update them
+    if (shared.is_open())
     {
-        return true;
+        constexpr int MaxSharedMoves = 32;
+
+        LearningMove sharedMoves[MaxSharedMoves];
+        bool         visited[MaxSharedMoves] = {};
+        const int    count                   = shared.probe(key, sharedMoves, MaxSharedMoves);
+
+        if (count)
+        {
+            visit_local(key, [&](const LearningMove& learningMove) {
+                for (int i = 0; i < count; ++i)
+                    if (sharedMoves[i].move == learningMove.move)
+                    {
+                        visited[i] = true;
+                        visitor(should_update(learningMove, sharedMoves[i]) ? sharedMoves[i]
+                                                                            : learningMove);
+                        return;
+                    }
+
+                visitor(learningMove);
+            });
+
+            for (int i = 0; i < count; ++i)
+                if (!visited[i])
+                    visitor(sharedMoves[i]);
+
+            return;
+        }
+    }
+
+    visit_local(key, visitor);
+}
+
+//Calls the visitor for each move of the given key, from the delta if it holds the
+//key, or else decoded from the sorted file
+template<typename Visitor>
+void LearningData::visit_local(Key key, const Visitor& visitor) const {
+    const auto [first, last] = HT.equal_range(key);
+    if (first != last)
+    {
+        for (auto it = first; it != last; ++it)
+            visitor(*it->second);
+
+        return;
     }
 
-    return learning_move.performance != existing_move.performance;
+    int            count;
+    const uint8_t* encoded = find_sorted(sorted, key, count);
+    for (int i = 0; encoded && i < count; ++i)
+        visitor(decode_move(encoded + i * EncodedMoveSize));
 }
 
 void LearningData::insert_or_update(PersistedLearningMove* plm, bool qLearning) {
+    //The delta must hold all the moves of the key before being updated
+    materialize(plm->key);
+
     // We search in the range of all the hash table entries with plm key
     const auto [first, second] = HT.equal_range(plm->key);
 
@@ -114,7 +720,7 @@ void LearningData::insert_or_update(PersistedLearningMove* plm, bool qLearning)
         HT.insert({plm->key, &plm->learningMove});
 
         //Flag for persisting
-        needPersisting = true;
+        mark_modified(plm->key);
 
         //Nothing else to do
         return;
@@ -133,7 +739,7 @@ void LearningData::insert_or_update(PersistedLearningMove* plm, bool qLearning)
         bestNewMoveCandidate = &plm->learningMove;
 
         //Flag for persisting
-        needPersisting = true;
+        mark_modified(plm->key);
     }
     else  //If the move exists, check if it better than the move we already have
     {
@@ -147,7 +753,7 @@ void LearningData::insert_or_update(PersistedLearningMove* plm, bool qLearning)
             bestNewMoveCandidate = existingMove;
 
             //Flag for persisting
-            needPersisting = true;
+            mark_modified(plm->key);
         }
     }
 
@@ -187,20 +793,245 @@ void LearningData::insert_or_update(PersistedLearningMove* plm, bool qLearning)
             *currentBestMove      = lm;
 
             //Flag for persisting
-            needPersisting = true;
+            mark_modified(plm->key);
+        }
+    }
+}
+
+namespace {
+//A run of moves sorted by key. When a run replaces the previous ones, its moves
+//drop those of the same key coming from the previous runs.
+struct ExperienceRun {
+    const PersistedLearningMove* moves;
+    size_t                       count;
+    bool                         replaces;
+};
+
+//Merges the moves of a key in the given list, as insert_or_update() does
+void merge_moves(vector<LearningMove>&        moves,
+                 const PersistedLearningMove* first,
+                 const PersistedLearningMove* last) {
+    for (const PersistedLearningMove* plm = first; plm != last; ++plm)
+    {
+        const auto itr = find_if(moves.begin(), moves.end(), [&](const LearningMove& lm) {
+            return lm.move == plm->learningMove.move;
+        });
+
+        if (itr == moves.end())
+            moves.push_back(plm->learningMove);
+        else if (should_update(*itr, plm->learningMove))
+            *itr = plm->learningMove;
+    }
+}
+
+//Merges the given ranges of the runs with a k-way merge. The moves of a key are
+//merged in the order of the runs.
+void merge_runs(const vector<ExperienceRun>&          runs,
+                vector<const PersistedLearningMove*>  begin,
+                const vector<const PersistedLearningMove*>& end,
+                vector<PersistedLearningMove>&        output) {
+    using Cursor = pair<Key, size_t>;
+
+    priority_queue<Cursor, vector<Cursor>, greater<Cursor>> heap;
+    for (size_t r = 0; r < runs.size(); ++r)
+        if (begin[r] != end[r])
+            heap.push({begin[r]->key, r});
+
+    vector<LearningMove> moves;
+    while (!heap.empty())
+    {
+        const Key key = heap.top().first;
+
+        moves.clear();
+        while (!heap.empty() && heap.top().first == key)
+        {
+            const size_t r = heap.top().second;
+            heap.pop();
+
+            const PersistedLearningMove* last = begin[r];
+            while (last != end[r] && last->key == key)
+                ++last;
+
+            if (runs[r].replaces)
+                moves.clear();
+
+            merge_moves(moves, begin[r], last);
+
+            begin[r] = last;
+            if (last != end[r])
+                heap.push({last->key, r});
         }
+
+        for (const LearningMove& learningMove : moves)
+            if (learningMove.depth != 0)
+                output.push_back({key, learningMove});
     }
 }
+}
+
+//Merges experience files, of any format, with the current experience, which is
+//then rewritten to "experience.exp". The files are read and sorted in parallel,
+//then each thread merges a range of keys of all of them.
+bool LearningData::merge(const vector<string>& filenames) {
+    if (isReadOnly || experiencePath.empty())
+        return false;
+
+    //Wait for the background compaction, which reads the sorted file
+    finish_compaction(true);
+
+    //An unsorted main file is not mapped: merge it first
+    vector<string> files;
+    if (!sortedFile.has_data() && file_exists(experiencePath))
+        files.push_back(experiencePath);
+
+    for (const string& fn : filenames)
+        if (!Util::is_same_file(fn, experiencePath))
+            files.push_back(fn);
+
+    const size_t threadCount = max(thread::hardware_concurrency(), 1u);
+
+    vector<PersistedLearningMove*> fileMoves(files.size());
+    vector<size_t>                 fileCounts(files.size());
+    vector<thread>                 threads;
+    atomic<size_t>                 nextFile(0);
+
+    for (size_t t = 0; t < min(threadCount, files.size()); ++t)
+        threads.emplace_back([&] {
+            for (size_t i; (i = nextFile++) < files.size();)
+                fileMoves[i] = read_run(files[i], fileCounts[i]);
+        });
+
+    for (auto& th : threads)
+        th.join();
+
+    //The delta replaces the moves of the main file, while the other files are
+    //merged on top of it
+    const vector<PersistedLearningMove> delta = sorted_delta();
+
+    //The sorted file is compressed: decode it to a run
+    vector<PersistedLearningMove> mapped;
+    mapped.reserve(sorted.moveCount);
+    for (SortedCursor cursor(sorted); cursor.next();)
+        for (int i = 0; i < cursor.count; ++i)
+            mapped.push_back({cursor.key, decode_move(cursor.moves + i * EncodedMoveSize)});
+
+    vector<ExperienceRun> runs;
+    runs.push_back({mapped.data(), mapped.size(), false});
+
+    const size_t mainFiles = !files.empty() && files[0] == experiencePath ? 1 : 0;
+    for (size_t i = 0; i < mainFiles; ++i)
+        runs.push_back({fileMoves[i], fileCounts[i], false});
+
+    runs.push_back({delta.data(), delta.size(), true});
+
+    for (size_t i = mainFiles; i < files.size(); ++i)
+        runs.push_back({fileMoves[i], fileCounts[i], false});
+
+    //Split the keys in ranges of the same size, as the keys are uniformly distributed
+    vector<vector<PersistedLearningMove>> parts(threadCount);
+    threads.clear();
+
+    for (size_t t = 0; t < threadCount; ++t)
+        threads.emplace_back([&, t] {
+            const Key lo = Key(t) * (~Key(0) / threadCount);
+            const Key hi = Key(t + 1) * (~Key(0) / threadCount);
+
+            vector<const PersistedLearningMove*> begin, end;
+            for (const ExperienceRun& run : runs)
+            {
+                auto bound = [&](Key k) {
+                    return lower_bound(run.moves, run.moves + run.count, k,
+                                       [](const PersistedLearningMove& plm, Key key) {
+                                           return plm.key < key;
+                                       });
+                };
+
+                begin.push_back(t == 0 ? run.moves : bound(lo));
+                end.push_back(t == threadCount - 1 ? run.moves + run.count : bound(hi));
+            }
+
+            merge_runs(runs, begin, end, parts[t]);
+        });
+
+    for (auto& th : threads)
+        th.join();
+
+    for (PersistedLearningMove* moves : fileMoves)
+        free(moves);
+
+    return replace_experience(parts);
+}
+
+//Returns the moves of the delta, sorted by key
+vector<PersistedLearningMove> LearningData::sorted_delta() const {
+    vector<PersistedLearningMove> delta;
+    delta.reserve(HT.size());
+    for (auto& kvp : HT)
+        delta.push_back({kvp.first, *kvp.second});
+
+    stable_sort(delta.begin(), delta.end(),
+                [](const PersistedLearningMove& a, const PersistedLearningMove& b) {
+                    return a.key < b.key;
+                });
+
+    return delta;
+}
+
+//Writes the given moves, sorted by key across the parts, to a new experience file,
+//which replaces the sorted file, the delta and the journals
+bool LearningData::replace_experience(const vector<vector<PersistedLearningMove>>& parts) {
+    ExperienceWriter writer(newExperiencePath);
+    for (const auto& part : parts)
+        for (const PersistedLearningMove& plm : part)
+            writer.add(plm.key, plm.learningMove);
+
+    //Keep the current experience if the new file could not be written
+    if (!writer.close())
+        return false;
+
+    clear();
+
+    remove(experiencePath.c_str());
+    rename(newExperiencePath.c_str(), experiencePath.c_str());
+    remove(journalPath.c_str());
+    remove(compactingJournalPath.c_str());
+
+    map_sorted(experiencePath);
+
+    needPersisting    = false;
+    needRewriting     = false;
+    journalCount      = 0;
+    compactionPending = false;
+
+    return true;
+}
 
 LearningData::LearningData() :
     isPaused(false),
     isReadOnly(false),
     needPersisting(false),
-    learningMode(LearningMode::Off) {}
+    needRewriting(false),
+    learningMode(LearningMode::Off),
+    journalCount(0),
+    compactionPending(false),
+    compactionSucceeded(false),
+    compactionDone(false) {}
 
 LearningData::~LearningData() { clear(); }
 
+//Flags the key of a new or updated move, to be appended to the journal
+void LearningData::mark_modified(Key key) {
+    needPersisting = true;
+    journalKeys.push_back(key);
+}
+
 void LearningData::clear() {
+    //Wait for the background compaction, which reads the sorted file
+    finish_compaction(true);
+
+    //Unmap the sorted experience file
+    unmap_sorted();
+
     //Clear hash table
     HT.clear();
 
@@ -217,104 +1048,437 @@ void LearningData::clear() {
 
     //Clear internal new moves data buffers
     newMovesDataBuffers.clear();
+
+    journalKeys.clear();
+}
+
+//Replays the committed batches of a journal in the delta. Returns false if the
+//journal ends with an interrupted batch.
+bool LearningData::replay(const string& filename, size_t& records) {
+    records = 0;
+
+    size_t fileSize;
+    void*  fileData = read_file(filename, fileSize);
+    if (!fileData)
+        return true;
+
+    //Save pointer to fileData to be freed later
+    mainDataBuffers.push_back(fileData);
+
+    records = replay_journal(static_cast<PersistedLearningMove*>(fileData),
+                             fileSize / sizeof(PersistedLearningMove),
+                             [&](PersistedLearningMove& plm, bool firstOfKey) {
+                                 if (firstOfKey)
+                                     HT.erase(plm.key);
+
+                                 HT.insert({plm.key, &plm.learningMove});
+                             });
+
+    return records * sizeof(PersistedLearningMove) == fileSize;
 }
 
 void LearningData::init(Alexander::OptionsMap& o) {
     OptionsMap& options = o;
     clear();
 
+    //Nothing is loaded, and nothing can be merged
+    experiencePath.clear();
+
     learningMode = identify_learning_mode(options["Persisted learning"]);
     if ((learningMode == LearningMode::Off) && !((bool) options["Experience Book"]))
+    {
+        shared.close();
         return;
+    }
 
-    load(Util::map_path("experience.exp"));
+    open(options);
+}
 
-    vector<string> slaveFiles;
+//Loads the experience: maps the sorted file, replays the journals and merges the
+//slave files
+void LearningData::open(Alexander::OptionsMap& options) {
+    //The paths are kept for the background compaction, which may finish at exit
+    experiencePath        = Util::map_path("experience.exp");
+    newExperiencePath     = Util::map_path("experience_new.exp");
+    journalPath           = Util::map_path(JournalFile);
+    compactingJournalPath = Util::map_path(CompactingJournalFile);
+
+    //The engines using the same experience file share the moves they learn
+    if (!(bool) options["Shared Experience"])
+        shared.close();
+    else if (!shared.open(experiencePath))
+        sync_cout << "info string Shared Experience is not available" << sync_endl;
+
+    //"experience_new.exp" is complete only if the engine stopped before it replaced
+    //"experience.exp" (see finish_compaction()). Otherwise it is the output of an
+    //interrupted compaction, whose journal is still there.
+    if (file_exists(experiencePath))
+        remove(newExperiencePath.c_str());
+    else
+        rename(newExperiencePath.c_str(), experiencePath.c_str());
 
-    //Just in case, check and load for "experience_new.exp" which will be present if
-    //previous saving operation failed (engine crashed or terminated)
-    string slaveFile = Util::map_path("experience_new.exp");
-    if (load("experience_new.exp"))
-        slaveFiles.push_back(slaveFile);
+    //Map the sorted experience file. Older unsorted files are converted to the
+    //sorted format below.
+    const bool unsortedMainFile = !map_sorted(experiencePath) && file_exists(experiencePath);
 
-    //Load slave experience files (if any)
+    //Replay the journals, the one being compacted first. A journal ending with an
+    //interrupted batch is consolidated below, as later batches cannot follow it.
+    compactionPending = file_exists(compactingJournalPath);
 
-    int i = 0;
-    while (true)
+    size_t     compactingCount;
+    const bool validCompactingJournal = replay(compactingJournalPath, compactingCount);
+    const bool validJournal           = replay(journalPath, journalCount);
+
+    vector<string> slaveFiles;
+
+    //Find slave experience files (if any)
+    for (int i = 0;; ++i)
     {
-        slaveFile = Util::map_path("experience" + to_string(i) + ".exp");
-        if (const bool loaded = load(slaveFile); !loaded)
+        const string slaveFile = Util::map_path("experience" + to_string(i) + ".exp");
+        if (!file_exists(slaveFile))
             break;
 
         slaveFiles.push_back(slaveFile);
-        ++i;
     }
 
     //We need to write all consolidated experience to disk
-    if (!slaveFiles.empty())
+    if (!slaveFiles.empty() || unsortedMainFile)
     {
-        persist(options);
-    }
+        if (merge(slaveFiles))
+        {
+            //Remove slave files
+            for (const string& fn : slaveFiles)
+                remove(fn.c_str());
+        }
+        else
+        {
+            //Keep everything in memory, and the files on disk
+            if (unsortedMainFile)
+                load(experiencePath);
 
-    //Remove slave files
-    for (const string& fn : slaveFiles)
+            for (const string& fn : slaveFiles)
+                load(fn);
+        }
+    }
+    else if (!validCompactingJournal || !validJournal)
     {
-        remove(fn.c_str());
+        needRewriting = true;
+        persist(options);
     }
 
     // Clear the 'needPersisting' flag
     needPersisting = false;
+    journalKeys.clear();
 }
 
-void LearningData::quick_reset_exp() {
-    std::cout << "Loading experience file: experience.exp" << std::endl;
+namespace {
+//The histograms of a maintenance: depths by steps of 4 plies, and scores
+constexpr int   DepthStep    = 4;
+constexpr int   DepthBuckets = 17;
+constexpr Value ScoreEdges[] = {-2000, -800, -400, -200, -100, -50, -20,
+                                20,    50,   100,  200,  400,  800,  2000};
+constexpr int   ScoreBuckets = int(std::size(ScoreEdges)) + 1;
+
+//The counters of a maintenance, kept by each thread and then summed
+struct MaintenanceStats {
+    size_t                      keys       = 0;
+    size_t                      moves      = 0;
+    size_t                      invalid    = 0;
+    size_t                      duplicates = 0;
+    size_t                      pruned     = 0;
+    size_t                      recomputed = 0;
+    array<size_t, DepthBuckets> depths{};
+    array<size_t, ScoreBuckets> scores{};
+
+    void add(const MaintenanceStats& other) {
+        keys += other.keys;
+        moves += other.moves;
+        invalid += other.invalid;
+        duplicates += other.duplicates;
+        pruned += other.pruned;
+        recomputed += other.recomputed;
+
+        for (int i = 0; i < DepthBuckets; ++i)
+            depths[i] += other.depths[i];
+
+        for (int i = 0; i < ScoreBuckets; ++i)
+            scores[i] += other.scores[i];
+    }
+};
+
+//The experience does not keep the positions, so that only the encoding of a move
+//can be checked: it must be a queen or a knight move, and the special moves must
+//start and end on their ranks
+bool is_valid_move(Move m) {
+    if (!m.is_ok())
+        return false;
+
+    const Square from = m.from_sq();
+    const Square to   = m.to_sq();
 
-    std::ifstream file("experience.exp", std::ifstream::binary | std::ifstream::ate);
-    if (!file)
+    switch (m.type_of())
     {
-        std::cerr << "Failed to load experience file" << std::endl;
-        return;
+    case PROMOTION :
+        return distance<File>(from, to) <= 1
+            && ((rank_of(from) == RANK_7 && rank_of(to) == RANK_8)
+                || (rank_of(from) == RANK_2 && rank_of(to) == RANK_1));
+
+    case EN_PASSANT :
+        return distance<File>(from, to) == 1
+            && ((rank_of(from) == RANK_5 && rank_of(to) == RANK_6)
+                || (rank_of(from) == RANK_4 && rank_of(to) == RANK_3));
+
+    case CASTLING :
+        return rank_of(from) == rank_of(to) && (rank_of(from) == RANK_1 || rank_of(from) == RANK_8);
+
+    default :
+        return bool((attacks_bb<QUEEN>(from) | attacks_bb<KNIGHT>(from)) & to);
     }
+}
+
+//Applies the maintenance tasks to the moves of a key, and counts them
+void maintain_moves(vector<LearningMove>&        moves,
+                    const ExperienceMaintenance& tasks,
+                    MaintenanceStats&            stats) {
+    //The moves of depth 0 are not persisted
+    moves.erase(remove_if(moves.begin(), moves.end(),
+                          [](const LearningMove& lm) { return lm.depth == 0; }),
+                moves.end());
+
+    if (tasks.clean)
+    {
+        //Keep the move preferred by should_update() among the duplicates
+        vector<LearningMove> cleanMoves;
+        for (const LearningMove& learningMove : moves)
+        {
+            if (!is_valid_move(learningMove.move))
+            {
+                ++stats.invalid;
+                continue;
+            }
 
-    const std::streamsize  file_size     = file.tellg();
-    constexpr unsigned int entry_size    = 24;
-    const unsigned int     total_entries = file_size / entry_size;
+            const auto itr =
+              find_if(cleanMoves.begin(), cleanMoves.end(),
+                      [&](const LearningMove& lm) { return lm.move == learningMove.move; });
 
-    file.close();
+            if (itr == cleanMoves.end())
+                cleanMoves.push_back(learningMove);
+            else
+            {
+                ++stats.duplicates;
+                if (should_update(*itr, learningMove))
+                    *itr = learningMove;
+            }
+        }
 
-    std::cout << "Total entries in the file: " << total_entries << std::endl;
+        moves.swap(cleanMoves);
+    }
 
-    if (const auto check = load("experience.exp"); !check)
+    if (tasks.minDepth > 0)
     {
-        std::cerr << "Failed to load experience file" << std::endl;
-        return;
+        const size_t count = moves.size();
+        moves.erase(remove_if(moves.begin(), moves.end(),
+                              [&](const LearningMove& lm) { return lm.depth < tasks.minDepth; }),
+                    moves.end());
+
+        stats.pruned += count - moves.size();
+    }
+
+    for (LearningMove& learningMove : moves)
+    {
+        if (tasks.recompute)
+        {
+            learningMove.performance =
+              WDLModel::get_win_probability(learningMove.score, learningMove.depth);
+            ++stats.recomputed;
+        }
+
+        ++stats.depths[min(learningMove.depth / DepthStep, DepthBuckets - 1)];
+        ++stats.scores[upper_bound(begin(ScoreEdges), end(ScoreEdges), learningMove.score)
+                       - begin(ScoreEdges)];
     }
 
-    std::cout << "Successfully loaded experience file" << std::endl;
+    stats.keys += !moves.empty();
+    stats.moves += moves.size();
+}
+
+void print_histogram(const string& title, const vector<string>& labels, const size_t* counts) {
+    const size_t total    = max(accumulate(counts, counts + labels.size(), size_t(0)), size_t(1));
+    const size_t maxCount = max(*max_element(counts, counts + labels.size()), size_t(1));
+
+    sync_cout << "info string " << title;
+    for (size_t i = 0; i < labels.size(); ++i)
+        cout << "\ninfo string " << setw(13) << labels[i] << setw(12) << counts[i] << setw(7)
+             << fixed << setprecision(1) << 100.0 * counts[i] / total << "% "
+             << string(40 * counts[i] / maxCount, '#');
+    cout << sync_endl;
+}
+
+void print_maintenance(const ExperienceMaintenance& tasks, const MaintenanceStats& stats) {
+    sync_cout << "info string Experience: " << stats.keys << " positions, " << stats.moves
+              << " moves";
+
+    if (tasks.clean)
+        cout << ", " << stats.invalid << " invalid and " << stats.duplicates
+             << " duplicate moves removed";
+
+    if (tasks.minDepth > 0)
+        cout << ", " << stats.pruned << " moves below depth " << tasks.minDepth << " pruned";
+
+    if (tasks.recompute)
+        cout << ", " << stats.recomputed << " performances recomputed";
+
+    cout << sync_endl;
+
+    if (!tasks.stats)
+        return;
+
+    vector<string> depthLabels;
+    for (int i = 0; i < DepthBuckets - 1; ++i)
+        depthLabels.push_back(to_string(i * DepthStep) + "-"
+                              + to_string((i + 1) * DepthStep - 1));
 
-    int entry_count = 0;
-    for (auto& [key, learning_move] : HT)
+    depthLabels.push_back(to_string((DepthBuckets - 1) * DepthStep) + "+");
+
+    vector<string> scoreLabels;
+    scoreLabels.push_back("< " + to_string(ScoreEdges[0]));
+    for (int i = 1; i < ScoreBuckets - 1; ++i)
+        scoreLabels.push_back(to_string(ScoreEdges[i - 1]) + ".." + to_string(ScoreEdges[i] - 1));
+
+    scoreLabels.push_back(">= " + to_string(ScoreEdges[ScoreBuckets - 2]));
+
+    print_histogram("Depth histogram", depthLabels, stats.depths.data());
+    print_histogram("Score histogram", scoreLabels, stats.scores.data());
+}
+}
+
+//Runs the maintenance tasks over the whole experience, with the threads of the pool.
+//Each thread processes a range of keys of the sorted file and of the delta, then the
+//moves are rewritten to "experience.exp", unless only the statistics are requested.
+//The experience is loaded for the maintenance if the learning is off.
+bool LearningData::maintain(const ExperienceMaintenance& tasks,
+                            OptionsMap&                  options,
+                            ThreadPool&                  threads) {
+    const bool modifies = tasks.recompute || tasks.minDepth > 0 || tasks.clean;
+    if (modifies && isReadOnly)
+        return false;
+
+    const bool wasOpen = !experiencePath.empty();
+    if (!wasOpen)
+        open(options);
+
+    //Wait for the background compaction, which reads the sorted file
+    finish_compaction(true);
+
+    const vector<PersistedLearningMove> delta = sorted_delta();
+
+    size_t total = sorted.keyCount;
+    for (size_t i = 0; i < delta.size(); ++i)
+        total += i == 0 || delta[i].key != delta[i - 1].key;
+
+    const size_t threadCount = threads.num_threads();
+
+    vector<vector<PersistedLearningMove>> parts(threadCount);
+    vector<MaintenanceStats>              stats(threadCount);
+    atomic<size_t>                        processed(0);
+    atomic<size_t>                        finished(0);
+
+    for (size_t t = 0; t < threadCount; ++t)
+        threads.run_on_thread(t, [&, t] {
+            //Split the keys in ranges of the same size, as in merge()
+            const Key  lo   = Key(t) * (~Key(0) / threadCount);
+            const Key  hi   = Key(t + 1) * (~Key(0) / threadCount);
+            const bool last = t + 1 == threadCount;
+
+            //Start from the block which may hold the first key of the range
+            const ExperienceBlock* block =
+              upper_bound(sorted.blocks, sorted.blocks + sorted.blockCount, lo,
+                          [](Key k, const ExperienceBlock& b) { return k < b.firstKey; });
+
+            SortedCursor cursor(sorted, block == sorted.blocks ? 0 : block - sorted.blocks - 1);
+
+            bool hasKey = cursor.next();
+            while (hasKey && cursor.key < lo)
+                hasKey = cursor.next();
+
+            auto d = lower_bound(delta.begin(), delta.end(), lo,
+                                 [](const PersistedLearningMove& plm, Key key) {
+                                     return plm.key < key;
+                                 });
+
+            vector<LearningMove> moves;
+            size_t               count = 0;
+
+            while (true)
+            {
+                const bool inFile  = hasKey && (last || cursor.key < hi);
+                const bool inDelta = d != delta.end() && (last || d->key < hi);
+                if (!inFile && !inDelta)
+                    break;
+
+                const Key key = inFile && (!inDelta || cursor.key < d->key) ? cursor.key : d->key;
+
+                //When a key is in the delta, the delta holds all the moves of this key
+                moves.clear();
+                if (inDelta && d->key == key)
+                    for (; d != delta.end() && d->key == key; ++d)
+                        moves.push_back(d->learningMove);
+                else
+                    for (int i = 0; i < cursor.count; ++i)
+                        moves.push_back(decode_move(cursor.moves + i * EncodedMoveSize));
+
+                if (inFile && cursor.key == key)
+                    hasKey = cursor.next();
+
+                maintain_moves(moves, tasks, stats[t]);
+
+                if (modifies)
+                    for (const LearningMove& learningMove : moves)
+                        parts[t].push_back({key, learningMove});
+
+                if (++count % 4096 == 0)
+                    processed += 4096;
+            }
+
+            processed += count % 4096;
+            ++finished;
+        });
+
+    //Report the progress every second, until all the threads have finished
+    for (TimePoint lastReport = now(); finished < threadCount;)
     {
-        entry_count++;
+        this_thread::sleep_for(chrono::milliseconds(10));
+
+        if (now() - lastReport >= 1000)
+        {
+            lastReport = now();
+            sync_cout << "info string Experience maintenance: "
+                      << min(processed * 100 / max(total, size_t(1)), size_t(100)) << "% of "
+                      << total << " positions" << sync_endl;
+        }
+    }
+
+    for (size_t t = 0; t < threadCount; ++t)
+        threads.wait_on_thread(t);
 
-        const auto old_performance = learning_move->performance;
-        const auto new_performance =
-          WDLModel::get_win_probability(learning_move->score, learning_move->depth);
+    for (size_t t = 1; t < threadCount; ++t)
+        stats[0].add(stats[t]);
 
-        std::cout << "Updating entry " << entry_count << "/" << total_entries << " Key " << key
-                  << "Value " << learning_move->score << "Depth " << learning_move->depth
-                  << ": old performance=" << static_cast<int>(old_performance)
-                  << ", new performance=" << static_cast<int>(new_performance) << std::endl;
+    const bool success = !modifies || replace_experience(parts);
+    if (success)
+        print_maintenance(tasks, stats[0]);
 
-        learning_move->performance = new_performance;
+    //Unload the experience if the learning is off
+    if (!wasOpen)
+    {
+        clear();
+        shared.close();
+        experiencePath.clear();
     }
 
-    needPersisting = true;
-    std::cout << "Finished updating performances. Total processed entries: " << entry_count
-              << std::endl;
+    return success;
 }
 
-
 void LearningData::set_learning_mode(Alexander::OptionsMap& options, const string& lm) {
     LearningMode newLearningMode = identify_learning_mode(lm);
     if (newLearningMode == learningMode)
@@ -327,8 +1491,14 @@ LearningMode LearningData::learning_mode() const { return learningMode; }
 
 void LearningData::persist(const Alexander::OptionsMap& o) {
     const OptionsMap& options = o;
+
+    //With a shared experience, the flusher saves the moves learned by all the engines
+    const bool flusher = shared.is_open() && shared.acquire_flusher();
+    if (flusher)
+        shared.drain([&](Key key, const LearningMove& lm) { add_local_learning(key, lm); });
+
     //Quick exit if we have nothing to persist
-    if (HT.empty() || !needPersisting)
+    if (!needPersisting && !needRewriting)
         return;
 
     if (isReadOnly)
@@ -339,21 +1509,23 @@ void LearningData::persist(const Alexander::OptionsMap& o) {
     }
 
     /*
-        To avoid any problems when saving to experience file, we will actually do the following:
-        1) Save new experience to "experience_new.exp"
+        The keys modified since the last call are appended to "experience.journal", as a batch
+        ending with a commit record: only complete batches are replayed at the next start.
+        When the journal grows too large, it is renamed to "experience_compacting.journal",
+        and merged with "experience.exp" in the background:
+        1) Save the merged experience to "experience_new.exp"
         2) Remove "experience.exp"
         3) Rename "experience_new.exp" to "experience.exp"
+        4) Remove "experience_compacting.journal"
 
-        This approach is fail proof so that the old file is only removed when the new file is successfully saved!
-        If, for whatever odd reason, the engine is able to execute step (1) and (2) and fails to execute step (3)
-        i.e., we end up with experience0.exp then it is not a problem since the file will be loaded anyway the next
-        time the engine starts!
+        This approach is fail proof: if the engine stops before (2) the compaction starts
+        again, after (2) the new file is renamed at the next start, and after (3) replaying
+        the compacted journal again is harmless.
     */
 
-    string experienceFilename;
-    string tempExperienceFilename;
-
-    if (static_cast<bool>(options["Concurrent Experience"]))
+    //The other engines of a shared experience save the moves which did not fit in the
+    //shared table to their own file
+    if (static_cast<bool>(options["Concurrent Experience"]) || (shared.is_open() && !flusher))
     {
         static string uniqueStr;
 
@@ -367,34 +1539,151 @@ void LearningData::persist(const Alexander::OptionsMap& o) {
             uniqueStr = ss.str();
         }
 
-        experienceFilename     = Util::map_path("experience-" + uniqueStr + ".exp");
-        tempExperienceFilename = Util::map_path("experience_new-" + uniqueStr + ".exp");
-    }
-    else
-    {
-        experienceFilename     = Util::map_path("experience.exp");
-        tempExperienceFilename = Util::map_path("experience_new.exp");
+        //Each engine writes its whole experience to its own file
+        rewrite(Util::map_path("experience-" + uniqueStr + ".exp"),
+                Util::map_path("experience_new-" + uniqueStr + ".exp"));
+        return;
     }
 
-    ofstream              outputFile(tempExperienceFilename, ofstream::trunc | ofstream::binary);
-    PersistedLearningMove persistedLearningMove;
-    for (auto& kvp : HT)
+    //Install the result of the background compaction, if it has finished
+    finish_compaction(needRewriting);
+
+    if (needRewriting)
     {
-        persistedLearningMove.key          = kvp.first;
-        persistedLearningMove.learningMove = *kvp.second;
-        if (persistedLearningMove.learningMove.depth != 0)
+        //The new file holds the whole experience, and replaces the journals
+        if (rewrite(experiencePath, newExperiencePath))
         {
-            outputFile.write(reinterpret_cast<char*>(&persistedLearningMove),
-                             sizeof(persistedLearningMove));
+            remove(journalPath.c_str());
+            remove(compactingJournalPath.c_str());
+
+            journalCount      = 0;
+            compactionPending = false;
         }
+
+        return;
+    }
+
+    if (!append_journal())
+        return;
+
+    if (!compactor.joinable()
+        && (compactionPending || journalCount > max(size_t(sorted.moveCount / 8), size_t(1) << 16)))
+        start_compaction();
+}
+
+//Appends the moves of the modified keys to the journal, as a single batch
+bool LearningData::append_journal() {
+    sort(journalKeys.begin(), journalKeys.end());
+    journalKeys.erase(unique(journalKeys.begin(), journalKeys.end()), journalKeys.end());
+
+    vector<PersistedLearningMove> batch;
+    for (const Key key : journalKeys)
+    {
+        const auto [first, last] = HT.equal_range(key);
+        for (auto it = first; it != last; ++it)
+            if (it->second->depth != 0)
+                batch.push_back({key, *it->second});
+    }
+
+    batch.push_back(journal_commit(int(batch.size())));
+
+    ofstream journal(journalPath, ofstream::app | ofstream::binary);
+    journal.write(reinterpret_cast<const char*>(batch.data()),
+                  static_cast<std::streamsize>(batch.size() * sizeof(PersistedLearningMove)));
+    journal.close();
+
+    //The journal may end with a part of the batch: rewrite the whole experience
+    //at the next call instead
+    if (!journal)
+    {
+        cerr << "info string Failed to write experience journal <" << journalPath << ">" << endl;
+        needRewriting = true;
+        return false;
     }
-    outputFile.close();
 
-    remove(experienceFilename.c_str());
-    rename(tempExperienceFilename.c_str(), experienceFilename.c_str());
+    journalCount += batch.size();
+    journalKeys.clear();
+
+    //Prevent persisting again without modifications
+    needPersisting = false;
+
+    return true;
+}
+
+//Writes the sorted file merged with the delta to a new file, which then replaces
+//both of them
+bool LearningData::rewrite(const string& filename, const string& tempFilename) {
+    vector<Key> deltaKeys;
+    deltaKeys.reserve(HT.size());
+    for (auto& kvp : HT)
+        deltaKeys.push_back(kvp.first);
+
+    sort(deltaKeys.begin(), deltaKeys.end());
+    deltaKeys.erase(unique(deltaKeys.begin(), deltaKeys.end()), deltaKeys.end());
+
+    //Keep the current experience if the new file could not be written
+    if (!write_sorted_experience(tempFilename, sorted, deltaKeys,
+                                 [&](Key key, const auto& write) {
+                                     const auto [first, last] = HT.equal_range(key);
+                                     for (auto it = first; it != last; ++it)
+                                         write(*it->second);
+                                 }))
+        return false;
+
+    clear();
+
+    remove(filename.c_str());
+    rename(tempFilename.c_str(), filename.c_str());
+
+    map_sorted(filename);
 
     //Prevent persisting again without modifications
     needPersisting = false;
+    needRewriting  = false;
+
+    return true;
+}
+
+//Renames the journal, so that later batches go to a new one, and merges it with
+//the sorted file in the background
+void LearningData::start_compaction() {
+    if (!compactionPending)
+    {
+        if (rename(journalPath.c_str(), compactingJournalPath.c_str()))
+            return;
+
+        compactionPending = true;
+        journalCount      = 0;
+    }
+
+    compactionDone = false;
+    compactor      = std::thread([this, snapshot = sorted] {
+        compactionSucceeded =
+          compact_experience(snapshot, compactingJournalPath, newExperiencePath);
+        compactionDone = true;
+    });
+}
+
+//Installs the sorted file written by the background compaction. The delta holds the
+//keys of the compacted journal, so it is still up to date with the new file.
+void LearningData::finish_compaction(bool wait) {
+    if (!compactor.joinable() || (!wait && !compactionDone))
+        return;
+
+    compactor.join();
+
+    if (!compactionSucceeded)
+        return;
+
+    unmap_sorted();
+
+    remove(experiencePath.c_str());
+    rename(newExperiencePath.c_str(), experiencePath.c_str());
+    remove(compactingJournalPath.c_str());
+
+    compactionPending = false;
+
+    map_sorted(experiencePath);
 }
 
 void LearningData::pause() { isPaused = true; }
@@ -402,6 +1691,15 @@ void LearningData::pause() { isPaused = true; }
 void LearningData::resume() { isPaused = false; }
 
 void LearningData::add_new_learning(Key key, const LearningMove& lm) {
+    //The shared table holds the moves learned by all the engines, until the flusher
+    //saves them. The moves which do not fit in it are kept locally.
+    if (shared.is_open() && !isReadOnly && shared.insert(key, lm))
+        return;
+
+    add_local_learning(key, lm);
+}
+
+void LearningData::add_local_learning(Key key, const LearningMove& lm) {
     //Allocate buffer to read the entire file
     auto* newPlm = static_cast<PersistedLearningMove*>(malloc(sizeof(PersistedLearningMove)));
     if (!newPlm)
@@ -422,92 +1720,78 @@ void LearningData::add_new_learning(Key key, const LearningMove& lm) {
     insert_or_update(newPlm, learningMode == LearningMode::Self);
 }
 
-int LearningData::probeByMaxDepthAndScore(Key key, const LearningMove*& learningMove) {
-    const LearningMove* maxDepthMove = nullptr;
-    int                 maxDepth     = -1;
-    int                 maxScore     = -1;
+//The moves of the sorted file are decoded on the fly, so they are returned by value
+int LearningData::probeByMaxDepthAndScore(Key key, LearningMove& learningMove) const {
+    int maxDepth = -1;
+    int maxScore = -1;
+    int siblings = 0;
 
-    // Iterate through the range of elements with the given key
-    auto range = HT.equal_range(key);
-    if (range.first == range.second)
-    {
-        learningMove = nullptr;
-        return 0;
-    }
-    const auto siblings = distance(range.first, range.second);
-    for (auto it = range.first; it != range.second; ++it)
-    {
-        LearningMove* move = it->second;
+    // Iterate through the moves with the given key
+    visit(key, [&](const LearningMove& move) {
+        ++siblings;
 
         // Check if the current move has a greater depth than the maximum depth found so far
-        if (move->depth > maxDepth)
+        if (move.depth > maxDepth)
         {
-            maxDepth     = move->depth;
-            maxScore     = move->score;
-            maxDepthMove = move;
+            maxDepth     = move.depth;
+            maxScore     = move.score;
+            learningMove = move;
         }
         // If the current move has the same depth as the maximum depth found so far,
         // check if it has a greater score
-        else if (move->depth == maxDepth && move->score > maxScore)
+        else if (move.depth == maxDepth && move.score > maxScore)
         {
-            maxScore     = move->score;
-            maxDepthMove = move;
+            maxScore     = move.score;
+            learningMove = move;
         }
-    }
-
-    // Return the reference to the LearningMove with the maximum depth and score (or nullptr if not found)
-    learningMove = maxDepthMove;
+    });
 
-    return static_cast<int>(siblings);
+    // The LearningMove with the maximum depth and score is valid if there are siblings
+    return siblings;
 }
 
-const LearningMove* LearningData::probe_move(Key key, Move move) {
-    auto range = HT.equal_range(key);
-
-    if (range.first == range.second)
-        return nullptr;
-
-    auto itr =
-      find_if(range.first, range.second, [&move](const auto& p) { return p.second->move == move; });
+bool LearningData::probe_move(Key key, Move move, LearningMove& learningMove) const {
+    bool found = false;
 
-    if (itr == range.second)
-        return nullptr;
+    visit(key, [&](const LearningMove& lm) {
+        if (!found && lm.move == move)
+        {
+            learningMove = lm;
+            found        = true;
+        }
+    });
 
-    return itr->second;
+    return found;
 }
 
 
-void LearningData::sortLearningMoves(std::vector<LearningMove*>& learningMoves) {
+void LearningData::sortLearningMoves(std::vector<LearningMove>& learningMoves) {
     std::sort(learningMoves.begin(), learningMoves.end(),
-              [](const LearningMove* a, const LearningMove* b) {
-                  if (a->depth != b->depth)
+              [](const LearningMove& a, const LearningMove& b) {
+                  if (a.depth != b.depth)
                   {
-                      return a->depth > b->depth;
+                      return a.depth > b.depth;
                   }
-                  const int winProbA = a->performance;
-                  const int winProbB = b->performance;
+                  const int winProbA = a.performance;
+                  const int winProbB = b.performance;
 
                   if (winProbA != winProbB)
                   {
                       return winProbA > winProbB;
                   }
-                  return a->score > b->score;
+                  return a.score > b.score;
               });
 }
-vector<LearningMove*> LearningData::probe(Alexander::Key key) {
-    vector<LearningMove*> result;
-    auto                  range = HT.equal_range(key);
-    for (auto it = range.first; it != range.second; ++it)
-    {
-        result.push_back(it->second);
-    }
+vector<LearningMove> LearningData::probe(Alexander::Key key) const {
+    vector<LearningMove> result;
+    visit(key, [&](const LearningMove& learningMove) { result.push_back(learningMove); });
 
     return result;
 }
 void LearningData::show_exp(const Position& pos) {
     sync_cout << pos << endl;
     cout << "Experience: ";
-    vector<LearningMove*> learningMoves = LD.probe(pos.key());
+    vector<LearningMove> learningMoves = LD.probe(pos.key());
     if (learningMoves.empty())
     {
         cout << "No experience data found for this position" << sync_endl;
@@ -519,9 +1803,9 @@ void LearningData::show_exp(const Position& pos) {
     cout << endl;
     for (const auto& move : learningMoves)
     {
-        const int winProb = move->performance;
-        cout << "move: " << UCIEngine::move(move->move, pos.is_chess960())
-             << " depth: " << move->depth << " value: " << move->score
+        const int winProb = move.performance;
+        cout << "move: " << UCIEngine::move(move.move, pos.is_chess960())
+             << " depth: " << move.depth << " value: " << move.score
              << " win probability: " << winProb << endl;
     }
     cout << sync_endl;
@@ -1,10 +1,14 @@
 #ifndef LEARN_H_INCLUDED
 #define LEARN_H_INCLUDED
 
+#include <atomic>
+#include <thread>
 #include <unordered_map>
 #include "../types.h"
 #include "../ucioption.h"
 #include "../position.h"
+#include "../book/file_mapping.h"
+#include "shared_experience.h"
 
 enum class LearningMode {
     Off      = 1,
@@ -19,6 +23,26 @@ struct LearningMove {
     int              performance = 100;
 };
 
+//Whether a learned move replaces the same move already learned
+inline bool should_update(const LearningMove existing_move, const LearningMove learning_move) {
+    if (learning_move.depth > existing_move.depth)
+    {
+        return true;
+    }
+
+    if (learning_move.depth < existing_move.depth)
+    {
+        return false;
+    }
+
+    if (learning_move.score != existing_move.score)
+    {
+        return true;
+    }
+
+    return learning_move.performance != existing_move.performance;
+}
+
 struct PersistedLearningMove {
     Alexander::Key key{};
     LearningMove   learningMove;
@@ -29,17 +53,86 @@ struct QLearningMove {
     int                   materialClamp;
 };
 
+//The tasks of an experience maintenance (see LearningData::maintain())
+struct ExperienceMaintenance {
+    bool             recompute = false;  //Recompute the performance from score and depth
+    Alexander::Depth minDepth  = 0;      //Remove the moves of a lower depth
+    bool             clean     = false;  //Remove the invalid and the duplicate moves
+    bool             stats     = false;  //Print the depth and score histograms
+};
+
+namespace Alexander {
+class ThreadPool;
+}
+
+//A mapped sorted experience file, whose moves are compressed (see learn.cpp)
+struct ExperienceBlock;
+struct SortedExperience {
+    const ExperienceBlock* blocks     = nullptr;
+    size_t                 blockCount = 0;
+    const unsigned char*   data       = nullptr;
+    size_t                 keyCount   = 0;
+    size_t                 moveCount  = 0;
+};
+
+//The experience file is sorted by key, and begins with a header record (see
+//is_experience_header()). It is mapped read-only and probed through its block
+//index, while the moves learned during the session, or loaded from unsorted
+//files, are kept in a hash table (the delta) until they are persisted. When a
+//key is in the delta, the delta holds all the moves of this key.
+//The modified keys are appended to a journal, which is merged with the sorted file
+//by a background compaction when it grows too large.
 class LearningData {
     bool         isPaused;
     bool         isReadOnly;
     bool         needPersisting;
+    bool         needRewriting;
     LearningMode learningMode;
 
+    FileMapping      sortedFile;
+    SortedExperience sorted;
+
     std::unordered_multimap<Alexander::Key, LearningMove*> HT;
     std::vector<void*>                                     mainDataBuffers;
     std::vector<void*>                                     newMovesDataBuffers;
-    bool                                                   load(const std::string& filename);
+    std::vector<Alexander::Key>                            journalKeys;
+
+    std::string experiencePath;
+    std::string newExperiencePath;
+    std::string journalPath;
+    std::string compactingJournalPath;
+
+    size_t            journalCount;
+    bool              compactionPending;
+    bool              compactionSucceeded;
+    std::atomic<bool> compactionDone;
+    std::thread       compactor;
+
+    SharedExperience shared;
+
+    void open(Alexander::OptionsMap& options);
+    bool load(const std::string& filename);
     void insert_or_update(PersistedLearningMove* plm, bool qLearning);
+    void add_local_learning(Alexander::Key key, const LearningMove& lm);
+    void mark_modified(Alexander::Key key);
+
+    bool replay(const std::string& filename, size_t& records);
+    bool append_journal();
+    bool rewrite(const std::string& filename, const std::string& tempFilename);
+    void start_compaction();
+    void finish_compaction(bool wait);
+    bool replace_experience(const std::vector<std::vector<PersistedLearningMove>>& parts);
+
+    std::vector<PersistedLearningMove> sorted_delta() const;
+
+    bool map_sorted(const std::string& filename);
+    void unmap_sorted();
+    void materialize(Alexander::Key key);
+
+    template<typename Visitor>
+    void visit(Alexander::Key key, const Visitor& visitor) const;
+    template<typename Visitor>
+    void visit_local(Alexander::Key key, const Visitor& visitor) const;
 
    public:
     LearningData();
@@ -49,7 +142,6 @@ class LearningData {
     void               resume();
     [[nodiscard]] bool is_paused() const { return isPaused; };
 
-    void quick_reset_exp();
     void set_learning_mode(Alexander::OptionsMap& options, const std::string& lm);
     [[nodiscard]] LearningMode learning_mode() const;
     [[nodiscard]] bool         is_enabled() const { return learningMode != LearningMode::Off; }
@@ -60,14 +152,18 @@ class LearningData {
     void clear();
     void init(Alexander::OptionsMap& o);
     void persist(const Alexander::OptionsMap& o);
+    bool merge(const std::vector<std::string>& filenames);
+    bool maintain(const ExperienceMaintenance& tasks,
+                  Alexander::OptionsMap&       options,
+                  Alexander::ThreadPool&       threads);
 
     void add_new_learning(Alexander::Key key, const LearningMove& lm);
 
-    int probeByMaxDepthAndScore(Alexander::Key key, const LearningMove*& learningMove);
-    const LearningMove*        probe_move(Alexander::Key key, Alexander::Move move);
-    std::vector<LearningMove*> probe(Alexander::Key key);
-    static void                sortLearningMoves(std::vector<LearningMove*>& learningMoves);
-    static void                show_exp(const Alexander::Position& pos);
+    int  probeByMaxDepthAndScore(Alexander::Key key, LearningMove& learningMove) const;
+    bool probe_move(Alexander::Key key, Alexander::Move move, LearningMove& learningMove) const;
+    std::vector<LearningMove> probe(Alexander::Key key) const;
+    static void               sortLearningMoves(std::vector<LearningMove>& learningMoves);
+    static void               show_exp(const Alexander::Position& pos);
 };
 
 extern LearningData LD;
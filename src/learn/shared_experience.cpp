@@ -0,0 +1,243 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdlib>
+#include <optional>
+#include "../misc.h"
+#include "../shm.h"
+#include "learn.h"
+#include "shared_experience.h"
+
+#if defined(__linux__) && !defined(__ANDROID__)
+    #include <signal.h>
+    #include <unistd.h>
+#endif
+
+using namespace std;
+using namespace Alexander;
+
+namespace {
+//The table holds 4M moves (64 MB). The moves of a key are found from the slot of the
+//key by linear probing, so that an insertion gives up when the table is almost full.
+constexpr size_t SharedExperienceSlots = size_t(1) << 22;
+constexpr size_t MaxProbes             = 64;
+
+//A move is published when its data is written, after its slot is claimed by its tag.
+//The tag identifies both the key and the move, so that two processes inserting the
+//same move of the same key claim the same slot.
+constexpr uint64_t DirtyBit = uint64_t(1) << 63;
+
+uint64_t tag_of(Key key, Move move) {
+    return key ^ (uint64_t(move.raw()) * 0x9E3779B97F4A7C15ULL);
+}
+
+uint64_t pack(const LearningMove& learningMove) {
+    const uint64_t score = uint16_t(int16_t(std::clamp(int(learningMove.score), -32768, 32767)));
+    const uint64_t depth = uint8_t(std::clamp(int(learningMove.depth), 0, 255));
+    const uint64_t perf  = uint8_t(std::clamp(learningMove.performance, 0, 255));
+
+    return learningMove.move.raw() | score << 16 | depth << 32 | perf << 40;
+}
+
+LearningMove unpack(uint64_t data) {
+    LearningMove learningMove;
+    learningMove.move        = Move(uint16_t(data));
+    learningMove.score       = Value(int16_t(uint16_t(data >> 16)));
+    learningMove.depth       = Depth(uint8_t(data >> 32));
+    learningMove.performance = uint8_t(data >> 40);
+
+    return learningMove;
+}
+}
+
+//The shared memory object must be trivially copyable, so that the slots are plain
+//integers, accessed as atomics
+struct SharedExperienceSlot {
+    uint64_t tag;
+    uint64_t data;
+};
+
+struct SharedExperienceTable {
+    uint64_t             flusher;  //The process id of the flusher, 0 if none
+    uint64_t             padding[7];
+    SharedExperienceSlot slots[SharedExperienceSlots];
+};
+
+static_assert(sizeof(atomic<uint64_t>) == sizeof(uint64_t)
+              && atomic<uint64_t>::is_always_lock_free);
+
+namespace {
+atomic<uint64_t>& as_atomic(uint64_t& value) {
+    return *reinterpret_cast<atomic<uint64_t>*>(&value);
+}
+
+const atomic<uint64_t>& as_atomic(const uint64_t& value) {
+    return *reinterpret_cast<const atomic<uint64_t>*>(&value);
+}
+}
+
+#if defined(__linux__) && !defined(__ANDROID__)
+struct SharedExperience::Memory {
+    optional<shm::SharedMemory<SharedExperienceTable>> shared;
+};
+#else
+struct SharedExperience::Memory {};
+#endif
+
+SharedExperience::SharedExperience() :
+    table(nullptr) {}
+
+SharedExperience::~SharedExperience() { close(); }
+
+//Opens the table of the given experience file, created by the first process
+bool SharedExperience::open(const string& experiencePath) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "/alx_exp_%016" PRIx64, hash_string(experiencePath));
+
+    if (is_open() && name == buf)
+        return true;
+
+    close();
+
+#if defined(__linux__) && !defined(__ANDROID__)
+    //The initial value is copied to the new table: its zero pages are not allocated
+    auto* initial = static_cast<SharedExperienceTable*>(calloc(1, sizeof(SharedExperienceTable)));
+    if (!initial)
+        return false;
+
+    memory         = make_unique<Memory>();
+    memory->shared = shm::create_shared<SharedExperienceTable>(buf, *initial);
+    free(initial);
+
+    if (!memory->shared)
+    {
+        memory.reset();
+        return false;
+    }
+
+    table = const_cast<SharedExperienceTable*>(&memory->shared->get());
+    name  = buf;
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+void SharedExperience::close() {
+    if (!is_open())
+        return;
+
+#if defined(__linux__) && !defined(__ANDROID__)
+    //Let another process flush the table
+    uint64_t self = uint64_t(getpid());
+    as_atomic(table->flusher).compare_exchange_strong(self, 0);
+#endif
+
+    table = nullptr;
+    memory.reset();
+    name.clear();
+}
+
+//Inserts a move, or updates it as LearningData does. Returns false if the table is
+//too full.
+bool SharedExperience::insert(Key key, const LearningMove& learningMove) {
+    const uint64_t tag  = tag_of(key, learningMove.move);
+    const uint64_t data = pack(learningMove) | DirtyBit;
+
+    if (!tag || !learningMove.move)
+        return false;
+
+    for (size_t i = 0; i < MaxProbes; ++i)
+    {
+        SharedExperienceSlot& slot = table->slots[(key + i) & (SharedExperienceSlots - 1)];
+
+        uint64_t current = as_atomic(slot.tag).load(memory_order_acquire);
+        if (!current && as_atomic(slot.tag).compare_exchange_strong(current, tag))
+        {
+            as_atomic(slot.data).store(data, memory_order_release);
+            return true;
+        }
+
+        if (current != tag)
+            continue;
+
+        //The slot is ours: replace its move while ours is better. It may not be
+        //published yet.
+        uint64_t existing = as_atomic(slot.data).load(memory_order_acquire);
+        do
+            if (existing && !should_update(unpack(existing), learningMove))
+                return true;
+        while (!as_atomic(slot.data).compare_exchange_weak(existing, data));
+
+        return true;
+    }
+
+    return false;
+}
+
+//Copies the published moves of the given key, and returns their number
+int SharedExperience::probe(Key key, LearningMove* moves, int maxMoves) const {
+    int count = 0;
+
+    for (size_t i = 0; i < MaxProbes && count < maxMoves; ++i)
+    {
+        const SharedExperienceSlot& slot = table->slots[(key + i) & (SharedExperienceSlots - 1)];
+
+        const uint64_t tag = as_atomic(slot.tag).load(memory_order_acquire);
+        if (!tag)
+            break;
+
+        const uint64_t data = as_atomic(slot.data).load(memory_order_acquire);
+        if (data && tag == tag_of(key, Move(uint16_t(data))))
+            moves[count++] = unpack(data);
+    }
+
+    return count;
+}
+
+//Makes this process the flusher, if there is none or if it has exited
+bool SharedExperience::acquire_flusher() {
+#if defined(__linux__) && !defined(__ANDROID__)
+    const uint64_t self    = uint64_t(getpid());
+    uint64_t       flusher = as_atomic(table->flusher).load(memory_order_acquire);
+
+    while (flusher != self)
+    {
+        if (flusher && (kill(pid_t(flusher), 0) == 0 || errno == EPERM))
+            return false;
+
+        if (as_atomic(table->flusher).compare_exchange_weak(flusher, self))
+            return true;
+    }
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+//Calls the visitor for each move inserted or updated since the last drain. A move
+//updated meanwhile stays new for the next drain.
+size_t SharedExperience::drain(const function<void(Key, const LearningMove&)>& visitor) {
+    size_t count = 0;
+
+    for (SharedExperienceSlot& slot : table->slots)
+    {
+        uint64_t data = as_atomic(slot.data).load(memory_order_acquire);
+        if (!(data & DirtyBit))
+            continue;
+
+        const LearningMove learningMove = unpack(data);
+        const Key          key =
+          as_atomic(slot.tag).load(memory_order_relaxed) ^ tag_of(0, learningMove.move);
+
+        as_atomic(slot.data).compare_exchange_strong(data, data & ~DirtyBit);
+
+        visitor(key, learningMove);
+        ++count;
+    }
+
+    return count;
+}
@@ -0,0 +1,41 @@
+#ifndef SHARED_EXPERIENCE_H_INCLUDED
+#define SHARED_EXPERIENCE_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include "../types.h"
+
+struct LearningMove;
+struct SharedExperienceTable;
+
+//A hash table in shared memory, where the engine processes using the same experience
+//file add the moves they learn, so that each one probes the learning of the others.
+//The moves are inserted without locks. One of the processes, the flusher, drains the
+//new moves to its own experience, which it saves to disk.
+class SharedExperience {
+    struct Memory;
+
+    std::unique_ptr<Memory> memory;
+    SharedExperienceTable*  table;
+    std::string             name;
+
+   public:
+    SharedExperience();
+    ~SharedExperience();
+
+    bool open(const std::string& experiencePath);
+    void close();
+
+    [[nodiscard]] bool is_open() const { return table != nullptr; }
+
+    bool insert(Alexander::Key key, const LearningMove& learningMove);
+    int  probe(Alexander::Key key, LearningMove* moves, int maxMoves) const;
+
+    bool   acquire_flusher();
+    size_t drain(const std::function<void(Alexander::Key, const LearningMove&)>& visitor);
+};
+
+#endif  // #ifndef SHARED_EXPERIENCE_H_INCLUDED
@@ -21,6 +21,7 @@
 #include <unordered_map>
 #include "evaluate.h"
 #include "endgame.h"
+#include "material.h"
 #include "psqt.h"
 //for classical end
 #include "bitboard.h"
@@ -52,6 +53,7 @@ int main(int argc, char* argv[]) {
     PSQT::init();
     Bitbases::init();
     Endgames::init();
+    Material::init();
     //for classical end
     uci->loop();
 
@@ -18,6 +18,7 @@
 
 #include <cassert>
 #include <cstring>  // For std::memset
+#include <vector>
 
 #include "material.h"
 #include "thread.h"
@@ -66,18 +67,56 @@ Endgame<KQKRPs> ScaleKQKRPs[] = {Endgame<KQKRPs>(WHITE), Endgame<KQKRPs>(BLACK)}
 Endgame<KPsK>   ScaleKPsK[]   = {Endgame<KPsK>(WHITE), Endgame<KPsK>(BLACK)};
 Endgame<KPKP>   ScaleKPKP[]   = {Endgame<KPKP>(WHITE), Endgame<KPKP>(BLACK)};
 
+// The material configurations are given by the number of pieces of each type and
+// color, indexed by color and piece type from PAWN to QUEEN
+using Counts = int[COLOR_NB][PIECE_TYPE_NB];
+
+// The table holds the configurations where no side has more pieces of a type than in
+// the initial position, that is 9 * 3 * 3 * 3 * 2 = 486 configurations per side. Their
+// index is the mixed-radix number of their counts, which is a minimal perfect hash.
+constexpr int MaxCount[PIECE_TYPE_NB] = {0, 8, 2, 2, 2, 1};
+constexpr int SideConfigs             = 9 * 3 * 3 * 3 * 2;
+
+std::vector<Material::Entry> Configs;
+
+// Returns the index of a configuration in the table, or -1 if it has promoted pieces
+int index_of(const Counts& count) {
+    int idx = 0;
+
+    for (Color c : {WHITE, BLACK})
+        for (int pt = PAWN; pt <= QUEEN; ++pt)
+        {
+            if (count[c][pt] > MaxCount[pt])
+                return -1;
+
+            idx = idx * (MaxCount[pt] + 1) + count[c][pt];
+        }
+
+    return idx;
+}
+
+Value non_pawn_material(const Counts& count, Color c) {
+    Value npm = VALUE_ZERO;
+
+    for (int pt = KNIGHT; pt <= QUEEN; ++pt)
+        npm += count[c][pt] * PieceValue[make_piece(c, PieceType(pt))];
+
+    return npm;
+}
+
 // Helper used to detect a given material distribution
-bool is_KXK(const Position& pos, Color us) {
-    return !more_than_one(pos.pieces(~us)) && pos.non_pawn_material(us) >= RookValueMg;
+bool is_KXK(const Counts& count, Color us) {
+    return !count[~us][PAWN] && !non_pawn_material(count, ~us)
+        && non_pawn_material(count, us) >= RookValueMg;
 }
 
-bool is_KBPsK(const Position& pos, Color us) {
-    return pos.non_pawn_material(us) == BishopValueMg && pos.count<PAWN>(us) >= 1;
+bool is_KBPsK(const Counts& count, Color us) {
+    return non_pawn_material(count, us) == BishopValueMg && count[us][PAWN] >= 1;
 }
 
-bool is_KQKRPs(const Position& pos, Color us) {
-    return !pos.count<PAWN>(us) && pos.non_pawn_material(us) == QueenValueMg
-        && pos.count<ROOK>(~us) == 1 && pos.count<PAWN>(~us) >= 1;
+bool is_KQKRPs(const Counts& count, Color us) {
+    return !count[us][PAWN] && non_pawn_material(count, us) == QueenValueMg
+        && count[~us][ROOK] == 1 && count[~us][PAWN] >= 1;
 }
 
 
@@ -114,25 +153,18 @@ ScoreForClassical imbalance(const int pieceCount[][PIECE_TYPE_NB]) {
 namespace Material {
 
 
-/// Material::probe() looks up the current position's material configuration in
-/// the material hash table. It returns a pointer to the Entry if the position
-/// is found. Otherwise a new Entry is computed and stored there, so we don't
-/// have to recompute all when the same material configuration occurs again.
-
-Entry* probe(const Position& pos) {
+namespace {
 
-    Key    key = pos.material_key();
-    Entry* e   = pos.this_thread()->materialTable[key];
+/// compute() fills the Entry of a material configuration
 
-    if (e->key == key)
-        return e;
+void compute(Entry* e, Key key, const Counts& count) {
 
     std::memset(e, 0, sizeof(Entry));
     e->key           = key;
     e->factor[WHITE] = e->factor[BLACK] = (uint8_t) SCALE_FACTOR_NORMAL;
 
-    Value npm_w = pos.non_pawn_material(WHITE);
-    Value npm_b = pos.non_pawn_material(BLACK);
+    Value npm_w = non_pawn_material(count, WHITE);
+    Value npm_b = non_pawn_material(count, BLACK);
     Value npm   = std::clamp(npm_w + npm_b, EndgameLimit, MidgameLimit);
 
     // Map total non-pawn material into [PHASE_ENDGAME, PHASE_MIDGAME]
@@ -142,13 +174,13 @@ Entry* probe(const Position& pos) {
     // material configuration. Firstly we look for a fixed configuration one, then
     // for a generic one if the previous search failed.
     if ((e->evaluationFunction = Endgames::probe<Value>(key)) != nullptr)
-        return e;
+        return;
 
     for (Color c : {WHITE, BLACK})
-        if (is_KXK(pos, c))
+        if (is_KXK(count, c))
         {
             e->evaluationFunction = &EvaluateKXK[c];
-            return e;
+            return;
         }
 
     // OK, we didn't find any special evaluation function for the current material
@@ -158,7 +190,7 @@ Entry* probe(const Position& pos) {
     if (sf)
     {
         e->scalingFunction[sf->strongSide] = sf;  // Only strong color assigned
-        return e;
+        return;
     }
 
     // We didn't find any specialized scaling function, so fall back on generic
@@ -166,28 +198,29 @@ Entry* probe(const Position& pos) {
     // case we don't return after setting the function.
     for (Color c : {WHITE, BLACK})
     {
-        if (is_KBPsK(pos, c))
+        if (is_KBPsK(count, c))
             e->scalingFunction[c] = &ScaleKBPsK[c];
 
-        else if (is_KQKRPs(pos, c))
+        else if (is_KQKRPs(count, c))
             e->scalingFunction[c] = &ScaleKQKRPs[c];
     }
 
-    if (npm_w + npm_b == VALUE_ZERO && pos.pieces(PAWN))  // Only pawns on the board
+    // Only pawns on the board
+    if (npm_w + npm_b == VALUE_ZERO && count[WHITE][PAWN] + count[BLACK][PAWN])
     {
-        if (!pos.count<PAWN>(BLACK))
+        if (!count[BLACK][PAWN])
         {
-            assert(pos.count<PAWN>(WHITE) >= 2);
+            assert(count[WHITE][PAWN] >= 2);
 
             e->scalingFunction[WHITE] = &ScaleKPsK[WHITE];
         }
-        else if (!pos.count<PAWN>(WHITE))
+        else if (!count[WHITE][PAWN])
         {
-            assert(pos.count<PAWN>(BLACK) >= 2);
+            assert(count[BLACK][PAWN] >= 2);
 
             e->scalingFunction[BLACK] = &ScaleKPsK[BLACK];
         }
-        else if (pos.count<PAWN>(WHITE) == 1 && pos.count<PAWN>(BLACK) == 1)
+        else if (count[WHITE][PAWN] == 1 && count[BLACK][PAWN] == 1)
         {
             // This is a special case because we set scaling functions
             // for both colors instead of only one.
@@ -199,12 +232,12 @@ Entry* probe(const Position& pos) {
     // Zero or just one pawn makes it difficult to win, even with a small material
     // advantage. This catches some trivial draws like KK, KBK and KNK and gives a
     // drawish scale factor for cases such as KRKBP and KmmKm (except for KBBKN).
-    if (!pos.count<PAWN>(WHITE) && npm_w - npm_b <= BishopValueMg)
+    if (!count[WHITE][PAWN] && npm_w - npm_b <= BishopValueMg)
         e->factor[WHITE] = uint8_t(npm_w < RookValueMg      ? SCALE_FACTOR_DRAW
                                    : npm_b <= BishopValueMg ? 4
                                                             : 14);
 
-    if (!pos.count<PAWN>(BLACK) && npm_b - npm_w <= BishopValueMg)
+    if (!count[BLACK][PAWN] && npm_b - npm_w <= BishopValueMg)
         e->factor[BLACK] = uint8_t(npm_b < RookValueMg      ? SCALE_FACTOR_DRAW
                                    : npm_w <= BishopValueMg ? 4
                                                             : 14);
@@ -213,12 +246,74 @@ Entry* probe(const Position& pos) {
     // for the bishop pair "extended piece", which allows us to be more flexible
     // in defining bishop pair bonuses.
     const int pieceCount[COLOR_NB][PIECE_TYPE_NB] = {
-      {pos.count<BISHOP>(WHITE) > 1, pos.count<PAWN>(WHITE), pos.count<KNIGHT>(WHITE),
-       pos.count<BISHOP>(WHITE), pos.count<ROOK>(WHITE), pos.count<QUEEN>(WHITE)},
-      {pos.count<BISHOP>(BLACK) > 1, pos.count<PAWN>(BLACK), pos.count<KNIGHT>(BLACK),
-       pos.count<BISHOP>(BLACK), pos.count<ROOK>(BLACK), pos.count<QUEEN>(BLACK)}};
+      {count[WHITE][BISHOP] > 1, count[WHITE][PAWN], count[WHITE][KNIGHT], count[WHITE][BISHOP],
+       count[WHITE][ROOK], count[WHITE][QUEEN]},
+      {count[BLACK][BISHOP] > 1, count[BLACK][PAWN], count[BLACK][KNIGHT], count[BLACK][BISHOP],
+       count[BLACK][ROOK], count[BLACK][QUEEN]}};
 
     e->score = (imbalance<WHITE>(pieceCount) - imbalance<BLACK>(pieceCount)) / 16;
+}
+
+}  // namespace
+
+
+/// Material::init() computes the entries of all the configurations of the table, with
+/// their specialized evaluation and scaling functions, so that Endgames::init() must
+/// be called first.
+
+void init() {
+
+    Configs.resize(SideConfigs * SideConfigs);
+
+    for (int idx = 0; idx < SideConfigs * SideConfigs; ++idx)
+    {
+        Counts count             = {};
+        int    rest              = idx;
+        int    pieceNb[PIECE_NB] = {};
+
+        for (Color c : {BLACK, WHITE})
+            for (int pt = QUEEN; pt >= PAWN; --pt)
+            {
+                count[c][pt] = rest % (MaxCount[pt] + 1);
+                rest /= MaxCount[pt] + 1;
+
+                pieceNb[make_piece(c, PieceType(pt))] = count[c][pt];
+            }
+
+        pieceNb[W_KING] = pieceNb[B_KING] = 1;
+
+        assert(index_of(count) == idx);
+
+        compute(&Configs[idx], Position::material_key(pieceNb), count);
+    }
+}
+
+
+/// Material::probe() looks up the current position's material configuration. Those
+/// without promoted pieces are all in the table. The others are looked up in the
+/// material hash table of the thread, where a new Entry is computed if the position
+/// is not found, so we don't have to recompute all when the same material
+/// configuration occurs again.
+
+Entry* probe(const Position& pos) {
+
+    const Counts count = {
+      {0, pos.count<PAWN>(WHITE), pos.count<KNIGHT>(WHITE), pos.count<BISHOP>(WHITE),
+       pos.count<ROOK>(WHITE), pos.count<QUEEN>(WHITE)},
+      {0, pos.count<PAWN>(BLACK), pos.count<KNIGHT>(BLACK), pos.count<BISHOP>(BLACK),
+       pos.count<ROOK>(BLACK), pos.count<QUEEN>(BLACK)}};
+
+    const int idx = index_of(count);
+
+    if (idx >= 0)
+        return &Configs[idx];
+
+    Key    key = pos.material_key();
+    Entry* e   = pos.this_thread()->materialTable[key];
+
+    if (e->key != key)
+        compute(e, key, count);
+
     return e;
 }
 
@@ -63,6 +63,7 @@ struct Entry {
 
 using Table = HashTable<Entry, 8192>;
 
+void   init();
 Entry* probe(const Position& pos);
 
 }  // namespace Alexander::Material
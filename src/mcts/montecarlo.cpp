@@ -18,13 +18,18 @@
 
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cmath>
 #include <cstring>  // For std::memset, std::memcmp
+#include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <new>
 #include <sstream>
-#include <unordered_map>
+#include <thread>
+#include <vector>
 
+#include "../memory.h"
 #include "../misc.h"
 #include "montecarlo.h"
 
@@ -62,25 +67,25 @@ inline bool comp_float(const double a, const double b, const double epsilon = 0.
 /// Comparison functions for edges
 ///////////////////////////////////////////////////////////////////////////////////////
 struct COMPARE_PRIOR {
-    inline bool operator()(const Edge* a, const Edge* b) const { return a->prior > b->prior; }
+    inline bool operator()(const Edge* a, const Edge* b) const { return a->prior() > b->prior(); }
 } ComparePrior;
 
 struct COMPARE_VISITS {
     inline bool operator()(const Edge* a, const Edge* b) const {
-        return a->visits > b->visits
-            || (comp_float(a->visits, b->visits, 0.005) && a->prior > b->prior);
+        return a->visits() > b->visits()
+            || (comp_float(a->visits(), b->visits(), 0.005) && a->prior() > b->prior());
     }
 } CompareVisits;
 
 struct COMPARE_MEAN_ACTION {
     inline bool operator()(const Edge* a, const Edge* b) const {
-        return a->meanActionValue > b->meanActionValue;
+        return a->mean_action_value() > b->mean_action_value();
     }
 } CompareMeanAction;
 
 struct COMPARE_ROBUST_CHOICE {
     inline bool operator()(const Edge* a, const Edge* b) const {
-        return (10 * a->visits + a->prior > 10 * b->visits + b->prior);
+        return (10 * a->visits() + a->prior() > 10 * b->visits() + b->prior());
     }
 } CompareRobustChoice;
 
@@ -111,11 +116,13 @@ class AutoSpinLock {
 
 MCTSHashTable       MCTS;
 Edge                EDGE_NONE;
-Spinlock            createLock;
 size_t              mctsThreads;
 size_t              mctsMultiStrategy;
 double              mctsMultiMinVisits;
+int                 mctsVirtualLoss = 1;
 std::atomic<size_t> MCTSNodeCount(0);
+std::atomic<size_t> MCTSPlayouts(0);
+std::atomic<size_t> MCTSExpansions(0);
 
 template<typename T>
 T TRand(const T min, const T max) {
@@ -126,75 +133,683 @@ T TRand(const T min, const T max) {
     return distribution(gen);
 }
 
-/// get_node() probes the Monte-Carlo hash table to find the node with the given
-/// position, creating a new entry if it doesn't exist yet in the table.
-/// The returned node is always valid.
-mctsNodeInfo* get_node(const MonteCarlo* mcts, const Position& p) {
+/// MCTSHashTable::reserve() allocates the bucket array, the node pool and the edge
+/// arena in the given memory budget. Nothing is done if the size did not change.
+void MCTSHashTable::reserve(size_t mbSize) {
 
-    Key           key1 = p.key();
-    Key           key2 = p.pawn_key();
-    mctsNodeInfo* node = nullptr;
+    if (mbSize == mbCapacity)
+        return;
+
+    free();
 
-    //Lock
-    LOCK(mcts, createLock);
-    if (MCTSNodeCount.load(std::memory_order_relaxed) >= MCTSMaxNodes)
+    // Each node takes two slots of the bucket array (the load factor of the
+    // table is at most 1/2) and MCTSEdgesPerNode edges of the arena on average.
+    constexpr size_t nodeSize =
+      2 * sizeof(MCTSSlot) + sizeof(mctsNodeInfo) + MCTSEdgesPerNode * sizeof(Edge);
+
+    nodeCapacity = std::max<size_t>(mbSize * 1024 * 1024 / nodeSize, MCTSBucketSize);
+    nodeCapacity = std::min<size_t>(nodeCapacity, FULL_INDEX);
+    edgeCapacity = nodeCapacity * MCTSEdgesPerNode;
+    bucketCount  = 2 * nodeCapacity / MCTSBucketSize;
+    mbCapacity   = mbSize;
+
+    buckets = static_cast<MCTSBucket*>(aligned_large_pages_alloc(bucketCount * sizeof(MCTSBucket)));
+    nodePool =
+      static_cast<mctsNodeInfo*>(aligned_large_pages_alloc(nodeCapacity * sizeof(mctsNodeInfo)));
+    edgePool = static_cast<Edge*>(aligned_large_pages_alloc(edgeCapacity * sizeof(Edge)));
+
+    if (!buckets || !nodePool || !edgePool)
     {
+        std::cerr << "Failed to allocate " << mbSize << "MB for the MCTS tree." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    std::memset(static_cast<void*>(buckets), 0, bucketCount * sizeof(MCTSBucket));
+    MCTSNodeCount = 0;
+    edgeCount     = 0;
+    full          = false;
+}
+
+/// MCTSHashTable::clear() destroys all the nodes of the tree. It must not be
+/// called while a search is running.
+void MCTSHashTable::clear() {
+
+    if (!buckets)
+        return;
+
+    const size_t n = std::min(MCTSNodeCount.load(), nodeCapacity);
+    for (size_t i = 0; i < n; ++i)
+        nodePool[i].~mctsNodeInfo();
+
+    std::memset(static_cast<void*>(buckets), 0, bucketCount * sizeof(MCTSBucket));
+    MCTSNodeCount = 0;
+    edgeCount     = 0;
+    full          = false;
+}
+
+void MCTSHashTable::free() {
+
+    clear();
+
+    aligned_large_pages_free(buckets);
+    aligned_large_pages_free(nodePool);
+    aligned_large_pages_free(edgePool);
+
+    buckets      = nullptr;
+    nodePool     = nullptr;
+    edgePool     = nullptr;
+    bucketCount  = 0;
+    nodeCapacity = 0;
+    edgeCapacity = 0;
+    mbCapacity   = 0;
+}
+
+/// MCTSHashTable::hashfull() returns an approximation of the tree occupation, in
+/// permille, as the maximum of the occupation of the node pool and the edge arena.
+int MCTSHashTable::hashfull() const {
+
+    if (!nodeCapacity)
+        return 0;
+
+    const size_t nodes = std::min(MCTSNodeCount.load(std::memory_order_relaxed), nodeCapacity);
+    const size_t edges = std::min(edgeCount.load(std::memory_order_relaxed), edgeCapacity);
+
+    return int(std::max(1000 * nodes / nodeCapacity, 1000 * edges / edgeCapacity));
+}
+
+/// MCTSHashTable::allocate_edges() reserves n consecutive edges in the edge arena.
+/// The edges are not constructed: this is done by the caller.
+Edge* MCTSHashTable::allocate_edges(int n) {
+
+    const size_t first = edgeCount.fetch_add(n, std::memory_order_relaxed);
+
+    if (first + n > edgeCapacity)
+    {
+        edgeCount.fetch_sub(n, std::memory_order_relaxed);
+        full.store(true, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    return &edgePool[first];
+}
+
+/// MCTSHashTable::find_or_insert() returns the node with the given keys, creating
+/// it if it doesn't exist yet. Returns nullptr when the table is full.
+mctsNodeInfo* MCTSHashTable::find_or_insert(Key key1, Key key2) {
+
+    if (!buckets)
         return nullptr;
+
+    assert(key1 != 0);
+
+    size_t b = mul_hi64(key1, bucketCount);
+
+    for (size_t probe = 0; probe < MAX_PROBES; ++probe, b = b + 1 < bucketCount ? b + 1 : 0)
+        for (MCTSSlot& slot : buckets[b].slot)
+        {
+            Key k = slot.key1.load(std::memory_order_acquire);
+
+            // Try to claim an empty slot. If another thread beats us, 'k' is
+            // updated with its key and we check it below like any other slot.
+            if (k == 0 && slot.key1.compare_exchange_strong(k, key1, std::memory_order_acq_rel))
+            {
+                const size_t idx = MCTSNodeCount.fetch_add(1, std::memory_order_relaxed);
+                if (idx >= nodeCapacity)
+                {
+                    MCTSNodeCount.fetch_sub(1, std::memory_order_relaxed);
+                    full.store(true, std::memory_order_relaxed);
+                    slot.index.store(FULL_INDEX, std::memory_order_release);
+                    return nullptr;
+                }
+
+                mctsNodeInfo* node = new (&nodePool[idx]) mctsNodeInfo();
+                node->key1         = key1;  // Zobrist hash of all pieces, including pawns
+                node->key2         = key2;  // Zobrist hash of pawns
+                node->generation   = generation;
+
+                slot.index.store(uint32_t(idx), std::memory_order_release);
+                return node;
+            }
+
+            if (k != key1)
+                continue;
+
+            // Wait until the owner of the slot has published the node
+            uint32_t idx;
+            while ((idx = slot.index.load(std::memory_order_acquire)) == NO_INDEX)
+                std::this_thread::yield();
+
+            if (idx == FULL_INDEX)
+                return nullptr;
+
+            mctsNodeInfo& node = nodePool[idx];
+            if (node.key2 == key2)
+            {
+                // Avoid dirtying the cache line when the node is already up to date
+                if (node.generation.load(std::memory_order_relaxed) != generation)
+                    node.generation.store(generation, std::memory_order_relaxed);
+
+                return &node;
+            }
+        }
+
+    full.store(true, std::memory_order_relaxed);
+    return nullptr;
+}
+
+/// MCTSHashTable::enter_search() and MCTSHashTable::leave_search() register the
+/// threads searching the tree, so that recycle_at_safepoint() knows how many
+/// threads it must wait for. A thread entering the search during a recycling
+/// waits for its end.
+void MCTSHashTable::enter_search() {
+
+    std::lock_guard<std::mutex> lk(recycleMutex);
+    ++activeSearches;
+}
+
+void MCTSHashTable::leave_search() {
+
+    std::lock_guard<std::mutex> lk(recycleMutex);
+    --activeSearches;
+    recycleCondition.notify_all();
+}
+
+/// MCTSHashTable::recycle_at_safepoint() is called by the searching threads when
+/// the tree is full, while they don't hold any node. The last thread reaching the
+/// safepoint recycles the tree, while the other ones wait for it.
+void MCTSHashTable::recycle_at_safepoint() {
+
+    std::unique_lock<std::mutex> lk(recycleMutex);
+
+    if (!is_full())
+        return;  // Another thread has already recycled the tree
+
+    const uint64_t epoch = recycleEpoch;
+    ++parkedSearches;
+
+    recycleCondition.wait(lk, [&] {
+        return recycleEpoch != epoch || parkedSearches >= activeSearches;
+    });
+
+    if (recycleEpoch == epoch)
+    {
+        recycle();
+
+        full           = false;
+        parkedSearches = 0;
+        ++recycleEpoch;
+        recycleCondition.notify_all();
+    }
+}
+
+/// MCTSHashTable::compact() destroys the nodes for which keep() is false, moves the
+/// other nodes and their edges to the beginning of the pools, and rebuilds the index
+/// of the nodes. No other thread may access the tree meanwhile.
+template<typename Predicate>
+void MCTSHashTable::compact(Predicate keep) {
+
+    const size_t count = std::min(MCTSNodeCount.load(), nodeCapacity);
+
+    // Compact the node pool, keeping the order of the nodes. The nodes are plain
+    // data, and no thread holds one, so we can move them as raw memory.
+    size_t kept = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (!keep(nodePool[i]))
+        {
+            nodePool[i].~mctsNodeInfo();
+            continue;
+        }
+
+        if (kept != i)
+            std::memcpy(static_cast<void*>(&nodePool[kept]), &nodePool[i], sizeof(mctsNodeInfo));
+
+        ++kept;
     }
-    // If the node already exists in the hash table, we want to return it.
-    // We search in the range of all the hash table entries with key "key1".
-    const auto [fst, snd] = MCTS.equal_range(key1);
-    auto       it1        = fst;
-    const auto it2        = snd;
-    while (it1 != it2)
+
+    // Compact the edge arena. Moving the edge blocks in the order of their
+    // addresses guarantees that a block never overwrites a block to be moved.
+    std::vector<mctsNodeInfo*> expanded;
+    for (size_t i = 0; i < kept; ++i)
+        if (nodePool[i].children)
+            expanded.push_back(&nodePool[i]);
+
+    std::sort(expanded.begin(), expanded.end(), [](const mctsNodeInfo* a, const mctsNodeInfo* b) {
+        return a->children < b->children;
+    });
+
+    Edge* next = edgePool;
+    for (mctsNodeInfo* node : expanded)
     {
-        node = *(&it1->second);
+        const int n = node->number_of_sons;
+        if (node->children != next)
+            std::memmove(static_cast<void*>(next), node->children, n * sizeof(Edge));
+
+        node->children = next;
+        next += n;
+    }
 
-        if (node->key1 == key1 && node->key2 == key2)
-            return node;
+    rebuild_index(kept);
+
+    MCTSNodeCount = kept;
+    edgeCount     = size_t(next - edgePool);
+}
+
+/// MCTSHashTable::rebuild_index() fills the bucket array with the first count nodes
+/// of the pool. The load factor of the table is at most 1/2, so we don't expect to
+/// fail (the node would just become unreachable).
+void MCTSHashTable::rebuild_index(size_t count) {
+
+    std::memset(static_cast<void*>(buckets), 0, bucketCount * sizeof(MCTSBucket));
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        size_t b     = mul_hi64(nodePool[i].key1, bucketCount);
+        bool   found = false;
 
-        ++it1;
+        for (size_t probe = 0; probe < MAX_PROBES && !found;
+             ++probe, b = b + 1 < bucketCount ? b + 1 : 0)
+            for (MCTSSlot& slot : buckets[b].slot)
+                if (slot.key1 == 0)
+                {
+                    slot.key1  = nodePool[i].key1;
+                    slot.index = uint32_t(i);
+                    found      = true;
+                    break;
+                }
     }
+}
 
-    // Node was not found, so we have to create a new one
-    node = new mctsNodeInfo();
-    MCTSNodeCount.fetch_add(1, std::memory_order_relaxed);
-    node->key1           = key1;          // Zobrist hash of all pieces, including pawns
-    node->key2           = key2;          // Zobrist hash of pawns
-    node->node_visits    = 0;             // number of visits by the Monte-Carlo algorithm
-    node->number_of_sons = 0;             // total number of legal moves
-    node->lastMove       = Move::none();  // the move between the parent and this node
-    node->ttValue        = VALUE_NONE;
-    node->AB             = false;
+/// MCTSHashTable::recycle() evicts the cold part of the tree, keeping at most half
+/// of the node pool and half of the edge arena. The nodes are scored by their number
+/// of visits, halved for each search since their last visit, and only the nodes with
+/// the best scores are kept. No other thread may access the tree meanwhile.
+void MCTSHashTable::recycle() {
 
-    //Insert into MCTS hash table
-    MCTS.insert(make_pair(key1, node));
+    const size_t count = std::min(MCTSNodeCount.load(), nodeCapacity);
 
-    return node;
+    // The score of a node is the bit length of its decayed number of visits, so
+    // that nodes which were never expanded have a score of 0.
+    auto score = [&](const mctsNodeInfo& node) {
+        const int age    = uint8_t(generation - node.generation);
+        uint64_t  visits = uint64_t(std::max(node.node_visits.load(), 0L)) >> std::min(age, 63);
+        int       bits   = 0;
+
+        for (; visits; visits >>= 1)
+            ++bits;
+
+        return bits;
+    };
+
+    constexpr int MaxScore = 64;
+    size_t        nodesByScore[MaxScore + 1]{}, edgesByScore[MaxScore + 1]{};
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        const int s = score(nodePool[i]);
+        nodesByScore[s]++;
+        edgesByScore[s] += size_t(nodePool[i].number_of_sons);
+    }
+
+    // Find the lowest score such that the nodes we keep fit in half of the tree
+    int    threshold = MaxScore + 1;
+    size_t keptNodes = 0;
+    size_t keptEdges = 0;
+
+    while (threshold > 1 && keptNodes + nodesByScore[threshold - 1] <= nodeCapacity / 2
+           && keptEdges + edgesByScore[threshold - 1] <= edgeCapacity / 2)
+    {
+        --threshold;
+        keptNodes += nodesByScore[threshold];
+        keptEdges += edgesByScore[threshold];
+    }
+
+    compact([&](const mctsNodeInfo& node) { return score(node) >= threshold; });
 }
 
-/// MonteCarlo::add_prior_to_node() adds the given (move,prior) pair as a new son for a node
-void MonteCarlo::add_prior_to_node(mctsNodeInfo* node, Move m, Reward prior) const {
+/// MCTSHashTable::find() returns the node with the given keys, or nullptr if it is
+/// not in the table. It must not be called while a search is running.
+mctsNodeInfo* MCTSHashTable::find(Key key1, Key key2) const {
 
-    LOCK(this, node);
+    size_t b = mul_hi64(key1, bucketCount);
+
+    for (size_t probe = 0; probe < MAX_PROBES; ++probe, b = b + 1 < bucketCount ? b + 1 : 0)
+        for (const MCTSSlot& slot : buckets[b].slot)
+        {
+            const Key k = slot.key1.load(std::memory_order_relaxed);
 
-    assert(node->number_of_sons < MAX_CHILDREN);
-    assert(prior >= 0 && prior <= 1.0);
+            if (k == 0)
+                return nullptr;
 
-    int n = node->number_of_sons;
-    if (n < MAX_CHILDREN)
+            const uint32_t idx = slot.index.load(std::memory_order_relaxed);
+            if (k == key1 && idx < nodeCapacity && nodePool[idx].key1 == key1
+                && nodePool[idx].key2 == key2)
+                return &nodePool[idx];
+        }
+
+    return nullptr;
+}
+
+/// MCTSHashTable::mark_subtree() stamps the node and all the nodes reachable from it
+/// through visited edges with the current generation.
+void MCTSHashTable::mark_subtree(Position& pos, mctsNodeInfo* node, int depth) {
+
+    node->generation = generation;
+
+    if (!node->children || depth >= MAX_PLY)
+        return;
+
+    StateInfo st;
+
+    for (int i = 0; i < node->number_of_sons; ++i)
     {
-        node->children[n]->visits          = 0;
-        node->children[n]->move            = m;
-        node->children[n]->prior           = prior;
-        node->children[n]->actionValue     = 0.0;
-        node->children[n]->meanActionValue = 0.0;
-        node->number_of_sons++;
+        const Edge& edge = node->children[i];
+
+        // The child of an edge which was never visited is not in the subtree,
+        // unless it is reached by another path.
+        if (edge.visits() == 0)
+            continue;
+
+        pos.do_move(edge.move, st, nullptr);
+
+        mctsNodeInfo* child = find(pos.key(), pos.pawn_key());
+        if (child && child->generation != generation)
+            mark_subtree(pos, child, depth + 1);
+
+        pos.undo_move(edge.move);
     }
-    else
+}
+
+/// MCTSHashTable::promote_root() is called before a new search, after new_search().
+/// The subtree of the root position, grown while searching the previous moves or
+/// while pondering, becomes the new tree, and all the other nodes are released in
+/// bulk. The number of visits of the root node carried over is kept for statistics.
+void MCTSHashTable::promote_root(Position& rootPos) {
+
+    reusedVisits = 0;
+
+    if (!buckets || MCTSNodeCount == 0)
+        return;
+
+    mctsNodeInfo* root = find(rootPos.key(), rootPos.pawn_key());
+
+    if (root)
     {
-        //Too many sons (should never come here)
-        assert(false);
+        reusedVisits = root->node_visits;
+        mark_subtree(rootPos, root, 0);
+    }
+
+    compact([&](const mctsNodeInfo& node) { return node.generation == generation; });
+    full = false;
+}
+
+// The snapshot file of the tree begins with a header, followed by one record
+// per node and by the edge arena, as a raw array of edges. The edges of each
+// node are referenced by their offset in the arena.
+namespace {
+
+constexpr char     SnapshotMagic[8] = {'A', 'L', 'X', 'M', 'C', 'T', 'S', '\0'};
+constexpr uint32_t SnapshotVersion  = 1;
+
+struct SnapshotHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t edgeSize;  // sizeof(Edge), to reject snapshots of other builds
+    uint64_t nodeCount;
+    uint64_t edgeCount;
+};
+
+struct SnapshotNode {
+    Key      key1;
+    Key      key2;
+    int64_t  visits;
+    uint64_t firstEdge;  // Offset of the first edge of the node in the arena
+    int32_t  sons;
+    int32_t  ttValue;
+    uint16_t lastMove;
+    uint8_t  AB;
+    uint8_t  padding[5];
+};
+
+static_assert(sizeof(SnapshotNode) == 48, "Unexpected SnapshotNode size");
+
+}
+
+/// MCTSHashTable::save() writes the whole tree to the given file. Returns false
+/// if the file could not be written.
+bool MCTSHashTable::save(const std::string& fileName) const {
+
+    std::ofstream file(fileName, std::ios::binary);
+    if (!file)
+        return false;
+
+    const size_t   count = buckets ? std::min(MCTSNodeCount.load(), nodeCapacity) : 0;
+    SnapshotHeader header{};
+
+    std::memcpy(header.magic, SnapshotMagic, sizeof(SnapshotMagic));
+    header.version   = SnapshotVersion;
+    header.edgeSize  = sizeof(Edge);
+    header.nodeCount = count;
+    header.edgeCount = count ? edgeCount.load() : 0;
+
+    std::vector<SnapshotNode> records(count);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        const mctsNodeInfo& node = nodePool[i];
+        SnapshotNode&       r    = records[i];
+
+        r.key1      = node.key1;
+        r.key2      = node.key2;
+        r.visits    = node.node_visits;
+        r.firstEdge = node.children ? uint64_t(node.children - edgePool) : 0;
+        r.sons      = node.children ? int32_t(node.number_of_sons) : 0;
+        r.ttValue   = node.ttValue;
+        r.lastMove  = node.lastMove.load().raw();
+        r.AB        = node.AB;
+    }
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(records.data()), count * sizeof(SnapshotNode));
+    file.write(reinterpret_cast<const char*>(edgePool), header.edgeCount * sizeof(Edge));
+
+    return bool(file);
+}
+
+/// MCTSHashTable::load() replaces the tree with the one saved in the given file,
+/// with a single sequential read. The tree must be large enough to hold it.
+/// Returns false, leaving the tree empty, if the file could not be loaded.
+bool MCTSHashTable::load(const std::string& fileName) {
+
+    std::ifstream file(fileName, std::ios::binary);
+    if (!file || !buckets)
+        return false;
+
+    SnapshotHeader header{};
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+    if (!file || std::memcmp(header.magic, SnapshotMagic, sizeof(SnapshotMagic))
+        || header.version != SnapshotVersion || header.edgeSize != sizeof(Edge))
+        return false;
+
+    if (header.nodeCount > nodeCapacity || header.edgeCount > edgeCapacity)
+    {
+        std::cerr << "The MCTS snapshot needs " << header.nodeCount << " nodes and "
+                  << header.edgeCount << " edges, increase MCTS Hash." << std::endl;
+        return false;
+    }
+
+    clear();
+
+    std::vector<SnapshotNode> records(header.nodeCount);
+    file.read(reinterpret_cast<char*>(records.data()), header.nodeCount * sizeof(SnapshotNode));
+    file.read(reinterpret_cast<char*>(edgePool), header.edgeCount * sizeof(Edge));
+
+    if (!file)
+        return false;
+
+    for (size_t i = 0; i < records.size(); ++i)
+    {
+        const SnapshotNode& r = records[i];
+
+        if (r.firstEdge + uint64_t(r.sons) > header.edgeCount)
+        {
+            // Corrupted file: destroy the nodes constructed so far
+            MCTSNodeCount = i;
+            clear();
+            return false;
+        }
+
+        mctsNodeInfo* node   = new (&nodePool[i]) mctsNodeInfo();
+        node->key1           = r.key1;
+        node->key2           = r.key2;
+        node->node_visits    = long(r.visits);
+        node->number_of_sons = r.sons;
+        node->lastMove       = Move(r.lastMove);
+        node->ttValue        = Value(r.ttValue);
+        node->AB             = r.AB;
+        node->generation     = generation;
+        node->children       = r.sons ? &edgePool[r.firstEdge] : nullptr;
+    }
+
+    rebuild_index(records.size());
+
+    MCTSNodeCount = records.size();
+    edgeCount     = size_t(header.edgeCount);
+    full          = false;
+
+    return true;
+}
+
+/// MCTSHashTable::stats() returns statistics of the tree: its size, the distribution
+/// of the visits of the nodes, and the statistics of the moves of the given position,
+/// if it is in the tree.
+std::string MCTSHashTable::stats(const Position& rootPos) const {
+
+    std::stringstream ss;
+
+    const size_t count = buckets ? std::min(MCTSNodeCount.load(), nodeCapacity) : 0;
+
+    size_t   expanded = 0, edges = 0, visitsByBits[65]{};
+    uint64_t totalVisits = 0, maxVisits = 0;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        const mctsNodeInfo& node   = nodePool[i];
+        const uint64_t      visits = uint64_t(std::max(node.node_visits.load(), 0L));
+        int                 bits   = 0;
+
+        for (uint64_t v = visits; v; v >>= 1)
+            ++bits;
+
+        visitsByBits[bits]++;
+        totalVisits += visits;
+        maxVisits = std::max(maxVisits, visits);
+
+        if (node.children)
+        {
+            ++expanded;
+            edges += size_t(node.number_of_sons);
+        }
+    }
+
+    ss << "MCTS tree: " << count << " nodes (" << expanded << " expanded), " << edges
+       << " edges, " << hashfull() << " permille full" << "\nNode visits: " << totalVisits
+       << " total, " << maxVisits << " max";
+
+    for (int b = 0; b <= 64; ++b)
+        if (visitsByBits[b])
+            ss << "\n  " << std::setw(12) << (b ? 1ULL << (b - 1) : 0)
+               << "+ visits: " << std::setw(10) << visitsByBits[b] << " nodes";
+
+    const mctsNodeInfo* root = count ? find(rootPos.key(), rootPos.pawn_key()) : nullptr;
+
+    if (!root || !root->children)
+        return ss.str();
+
+    EdgeArray children;
+    const int n = root->number_of_sons;
+    for (int k = 0; k < n; k++)
+        children[k] = &root->children[k];
+
+    std::sort(children.begin(), children.begin() + n, [](const Edge* a, const Edge* b) {
+        return a->visits() > b->visits();
+    });
+
+    ss << "\nRoot: " << root->node_visits << " visits";
+
+    for (int k = 0; k < n; k++)
+        ss << "\n  " << std::setw(6) << UCIEngine::move(children[k]->move, rootPos.is_chess960())
+           << std::fixed << std::setprecision(0) << " visits " << std::setw(10)
+           << children[k]->visits() << std::setprecision(4) << " mean "
+           << children[k]->mean_action_value() << " prior " << children[k]->prior();
+
+    return ss.str();
+}
+
+/// get_node() probes the Monte-Carlo hash table to find the node with the given
+/// position, creating a new entry if it doesn't exist yet in the table.
+/// Returns nullptr when the table is full.
+mctsNodeInfo* get_node(const Position& p) { return MCTS.find_or_insert(p.key(), p.pawn_key()); }
+
+/// backup_benchmark() measures the throughput of the edge updates done by backup()
+/// when 1, 2, 4, ... threads, up to maxThreads, update the same few edges, as the
+/// threads of the MCTS do near the root. It also checks that no update was lost.
+void backup_benchmark(int maxThreads, TimePoint millis) {
+
+    constexpr int    EdgeCount = 4;
+    constexpr Reward reward    = 0.75;  // Exactly representable in fixed point
+
+    std::cerr << "\nThreads   Backups   Backups/second   Consistent" << std::endl;
+
+    for (int threadCount = 1; threadCount <= std::max(maxThreads, 1); threadCount *= 2)
+    {
+        Edge                     edges[EdgeCount];
+        std::atomic<bool>        stop = false;
+        std::vector<uint64_t>    backups(threadCount);
+        std::vector<std::thread> threads;
+
+        const TimePoint start = now();
+
+        for (int i = 0; i < threadCount; ++i)
+            threads.emplace_back([&, i] {
+                uint64_t n = 0;
+
+                for (; !stop.load(std::memory_order_relaxed); ++n)
+                {
+                    Edge& edge = edges[(n + i) % EdgeCount];
+                    edge.add_virtual_loss(mctsVirtualLoss);
+                    edge.add_reward(reward, mctsVirtualLoss);
+                }
+
+                backups[i] = n;
+            });
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(millis));
+        stop = true;
+
+        for (auto& th : threads)
+            th.join();
+
+        const TimePoint elapsed = std::max<TimePoint>(now() - start, 1);
+        uint64_t        total   = 0;
+        double          visits  = 0.0;
+        Reward          sum     = 0.0;
+
+        for (uint64_t n : backups)
+            total += n;
+
+        for (const Edge& edge : edges)
+        {
+            visits += edge.visits();
+            sum += edge.action_value();
+        }
+
+        const bool consistent = visits == double(total) && sum == reward * double(total);
+
+        std::cerr << std::setw(7) << threadCount << std::setw(10) << total << std::setw(17)
+                  << 1000 * total / elapsed << std::setw(13) << (consistent ? "yes" : "no")
+                  << std::endl;
     }
 }
 
@@ -204,15 +819,29 @@ void MonteCarlo::search(Alexander::ThreadPool&        threads,
                         bool                          isMainThread,
                         Search::Worker*               worker) {
 
+    // Recycle the tree if the root could not be stored in it
+    if ((root == nullptr || root->node_visits == 0) && !recycle_tree())
+        return;
+
     mctsNodeInfo* node = nullptr;
     AB_Rollout         = false;
     Reward reward      = value_to_reward(
       VALUE_DRAW);  //TODO: Perhaps we should use static_value() here instead of 'VALUE_DRAW'
+    size_t playouts    = 0;
 
-    while (computational_budget(threads, limits) && (node = tree_policy(threads, limits)))
+    while (computational_budget(threads, limits))
     {
+        // Recycle the cold part of the tree if it is full. Here we don't hold any node.
+        if (MCTS.is_full() && !recycle_tree())
+            break;
+
+        if (!(node = tree_policy(threads, limits)))
+            break;
+
         LOCK(this, node);
 
+        ++playouts;
+
         if (AB_Rollout)
         {
             Value value = evaluate_with_minimax(node, std::min(ply, MAX_PLY - ply - 2));
@@ -246,6 +875,8 @@ void MonteCarlo::search(Alexander::ThreadPool&        threads,
             emit_pv(worker, threads);
     }
 
+    MCTSPlayouts.fetch_add(playouts, std::memory_order_relaxed);
+
     if (ply >= 1)
         backup(reward, AB_Rollout);
 
@@ -260,10 +891,14 @@ MonteCarlo::MonteCarlo(Position&           p,
     pos(p),
     thisThread(worker),
     tt(transpositionTable) {
+    MCTS.enter_search();
     default_parameters();
     create_root(worker);
 }
 
+/// MonteCarlo::~MonteCarlo() is the destructor for the MonteCarlo class
+MonteCarlo::~MonteCarlo() { MCTS.leave_search(); }
+
 /// MonteCarlo::create_root(Search::Worker* worker) initializes the Monte-Carlo tree with the given position
 void MonteCarlo::create_root(Search::Worker* worker) {
 
@@ -303,7 +938,11 @@ void MonteCarlo::create_root(Search::Worker* worker) {
     std::memset(nodesBuffer, 0, sizeof(nodesBuffer));
 
     //Create or get the root node
-    root = nodes[ply] = get_node(this, pos);
+    root = nodes[ply] = get_node(pos);
+
+    // The node table is full: search() and print_children() will do nothing
+    if (root == nullptr)
+        return;
 
     LOCK(this, root);
 
@@ -311,6 +950,26 @@ void MonteCarlo::create_root(Search::Worker* worker) {
         generate_moves(root);
 }
 
+/// MonteCarlo::recycle_tree() waits for the other threads to recycle the tree, and
+/// gets the root again. Returns false if the root could still not be expanded.
+bool MonteCarlo::recycle_tree() {
+
+    assert(ply == 1);
+
+    MCTS.recycle_at_safepoint();
+
+    root = nodes[ply] = get_node(pos);
+    if (root == nullptr)
+        return false;
+
+    LOCK(this, root);
+
+    if (root->node_visits == 0)
+        generate_moves(root);
+
+    return root->node_visits > 0;
+}
+
 /// MonteCarlo::computational_budget() returns true the search is still
 /// in the computational budget (time limit, or number of nodes, etc.)
 bool MonteCarlo::computational_budget(Alexander::ThreadPool&        threads,
@@ -352,16 +1011,16 @@ mctsNodeInfo* MonteCarlo::tree_policy(Alexander::ThreadPool&        threads,
 
         node->node_visits++;
 
-        // Add a virtual loss to this edge (for load balancing in the parallel MCTS)
-        edge->visits          = edge->visits + 1.0;
-        edge->meanActionValue = edge->actionValue / edge->visits;
+        // Add a virtual loss to this edge, so that the other threads descending the
+        // tree meanwhile prefer other edges (for load balancing in the parallel MCTS)
+        edge->add_virtual_loss(mctsVirtualLoss);
 
         assert(m.is_ok());
         assert(pos.legal(m));
 
         do_move(m);
 
-        nodes[ply] = get_node(this, pos);
+        nodes[ply] = get_node(pos);
         if (nodes[ply] == nullptr)
         {
             break;
@@ -400,7 +1059,10 @@ Reward MonteCarlo::playout_policy(mctsNodeInfo* node) {
     if (node->node_visits == 0)
     {
         generate_moves(node);
-        assert(node->node_visits == 1);
+
+        // The edge arena is full: use the best prior as the reward of the playout
+        if (node->node_visits == 0)
+            return value_to_reward(node->ttValue);
     }
 
     if (node->number_of_sons == 0)
@@ -411,7 +1073,7 @@ Reward MonteCarlo::playout_policy(mctsNodeInfo* node) {
     // Here we can just return the prior value of the first legal moves, because the
     // legal moves were sorted by prior in the generate_moves() call.
 
-    return node->children[0]->prior;
+    return node->children[0].prior();
 }
 
 /// MonteCarlo::backup() implements the strategy for accumulating rewards up the tree
@@ -419,7 +1081,6 @@ Reward MonteCarlo::playout_policy(mctsNodeInfo* node) {
 Value MonteCarlo::backup(Reward r, bool AB_Mode) {
 
     assert(ply >= 1);
-    double weight = 1.0;
 
     while (ply != 1)
     {
@@ -431,22 +1092,18 @@ Value MonteCarlo::backup(Reward r, bool AB_Mode) {
 
         if (AB_Mode)
         {
-            edge->prior = r;
-            AB_Mode     = false;
+            edge->set_prior(r);
+            AB_Mode = false;
         }
 
-        // Compensate the virtual loss we had set in tree_policy()
-        edge->visits = edge->visits - 1.0;
+        // Update the statistics of the edge, reverting the virtual loss we had
+        // set in tree_policy()
+        edge->add_reward(r, mctsVirtualLoss);
 
-        // Update the statistics of the edge
-        edge->visits          = edge->visits + weight;
-        edge->actionValue     = edge->actionValue + weight * r;
-        edge->meanActionValue = edge->actionValue / edge->visits;
+        assert(edge->mean_action_value() >= 0.0);
+        assert(edge->mean_action_value() <= 1.0);
 
-        assert(edge->meanActionValue >= 0.0);
-        assert(edge->meanActionValue <= 1.0);
-
-        const double minimax = best_child(nodes[ply], STAT_MEAN)->meanActionValue;
+        const double minimax = best_child(nodes[ply], STAT_MEAN)->mean_action_value();
 
         // Propagate the minimax value up the tree instead of the playout value ?
         r = r * (1.0 - BACKUP_MINIMAX) + minimax * BACKUP_MINIMAX;
@@ -475,13 +1132,12 @@ Edge* MonteCarlo::best_child(mctsNodeInfo* node, EdgeStatistic statistic) const
     for (int k = 0; k < node->number_of_sons; k++)
     {
         const double r =
-          statistic == STAT_VISITS ? node->children[k]->visits.load(std::memory_order_relaxed)
-          : statistic == STAT_MEAN
-            ? node->children[k]->meanActionValue.load(std::memory_order_relaxed)
+          statistic == STAT_VISITS ? node->children[k].visits()
+          : statistic == STAT_MEAN ? node->children[k].mean_action_value()
           : statistic == STAT_UCB
-            ? ucb(node->children[k], node->node_visits.load(std::memory_order_relaxed), false)
+            ? ucb(&node->children[k], node->node_visits.load(std::memory_order_relaxed), false)
           : statistic == STAT_PRIOR
-            ? ucb(node->children[k], node->node_visits.load(std::memory_order_relaxed), true)
+            ? ucb(&node->children[k], node->node_visits.load(std::memory_order_relaxed), true)
             : 0.0;
 
         if (r > bestValue)
@@ -491,7 +1147,7 @@ Edge* MonteCarlo::best_child(mctsNodeInfo* node, EdgeStatistic statistic) const
         }
     }
 
-    return node->children[best];
+    return &node->children[best];
 }
 
 /// MonteCarlo::should_emit_pv() checks if it should write the pv of the game tree.
@@ -534,8 +1190,10 @@ void MonteCarlo::emit_pv(Search::Worker* worker, Alexander::ThreadPool& threads)
 
     int n = root->number_of_sons;
 
-    // Make a local copy of the children of the root, and sort
-    EdgeArray list(root->children);
+    // Make a local list of the children of the root, and sort
+    EdgeArray list;
+    for (int k = 0; k < n; k++)
+        list[k] = &root->children[k];
 
     if (mctsThreads > 1)
         std::sort(list.begin(), list.begin() + n, ComparePrior);
@@ -553,7 +1211,7 @@ void MonteCarlo::emit_pv(Search::Worker* worker, Alexander::ThreadPool& threads)
         {
             rootMoves.push_back(Search::RootMove(list[k]->move));
             const size_t index             = rootMoves.size() - 1;
-            rootMoves[index].previousScore = reward_to_value(list[k]->meanActionValue);
+            rootMoves[index].previousScore = reward_to_value(list[k]->mean_action_value());
             rootMoves[index].score         = rootMoves[index].previousScore;
             rootMoves[index].selDepth      = maximumPly;
             if (k > 0)
@@ -569,7 +1227,7 @@ void MonteCarlo::emit_pv(Search::Worker* worker, Alexander::ThreadPool& threads)
         {
             cnt++;
             do_move(move);
-            mctsNodeInfo* node = nodes[ply] = get_node(this, pos);
+            mctsNodeInfo* node = nodes[ply] = get_node(pos);
             if (node == nullptr)
             {
                 break;
@@ -711,42 +1369,56 @@ void MonteCarlo::generate_moves(mctsNodeInfo* node) {
     Move       move;
     int        moveCount = 0;
 
-    // Generate the legal moves and calculate their priors
-    Reward bestPrior = REWARD_MATED;
+    MovePrior list[MAX_CHILDREN];
+
+    // Generate the legal moves in one move ordering pass, then calculate their
+    // priors in one batch
     while (((move = mp.next_move()) != Move::none()))
         if (pos.legal(move))
+            list[moveCount++] = {move, REWARD_NONE};
+
+    calculate_priors(list, moveCount);
+
+    Reward bestPrior = REWARD_MATED;
+    for (int k = 0; k < moveCount; k++)
+    {
+        Reward& prior = list[k].prior;
+        if (prior > bestPrior)
+        {
+            node->ttValue = reward_to_value(prior);
+            bestPrior     = prior;
+        }
+        if (kingInDanger)
         {
-            stack[ply].moveCount = ++moveCount;
-            Reward prior         = calculate_prior(move);
-            if (prior > bestPrior)
+            if (type_of(pos.moved_piece(list[k].move)) == KING)
             {
-                node->ttValue = reward_to_value(prior);
-                bestPrior     = prior;
+                prior = std::min(1.0, prior + 0.3);
             }
-            if (kingInDanger)
+            if (pos.gives_check(list[k].move))
             {
-                if (type_of(pos.moved_piece(move)) == KING)
-                {
-                    prior = std::min(1.0, prior + 0.3);
-                }
-                if (pos.gives_check(move))
-                {
-                    prior = std::min(1.0, prior + 0.2);
-                }
+                prior = std::min(1.0, prior + 0.2);
             }
-            add_prior_to_node(node, move, prior);
         }
+    }
 
     // Sort the moves according to their prior value
-    int n = node->number_of_sons;
-    if (n > 0)
-    {
-        EdgeArray& children = node->children;
-        std::stable_sort(children.begin(), children.begin() + n, ComparePrior);
-    }
+    std::stable_sort(list, list + moveCount,
+                     [](const MovePrior& a, const MovePrior& b) { return a.prior > b.prior; });
+
+    // Store the edges in the arena. If it is full, the node stays unexpanded.
+    Edge* children = moveCount > 0 ? MCTS.allocate_edges(moveCount) : nullptr;
+    if (moveCount > 0 && !children)
+        return;
+
+    for (int k = 0; k < moveCount; k++)
+        new (&children[k]) Edge(list[k].move, list[k].prior);
+
+    node->children       = children;
+    node->number_of_sons = moveCount;
 
     // Indicate that we have just expanded the current node
     node->node_visits++;
+    MCTSExpansions.fetch_add(1, std::memory_order_relaxed);
 }
 
 
@@ -779,7 +1451,10 @@ Value MonteCarlo::evaluate_with_minimax(const Depth d) const {
 
     return thisThread->minimax_value(pos, &stack[ply], d);
 }
-Value MonteCarlo::evaluate_with_minimax(mctsNodeInfo* node, Depth d) const {
+
+/// MonteCarlo::evaluate_with_minimax() with a guess of the value of the current
+/// position searches with an aspiration window centered on this guess.
+Value MonteCarlo::evaluate_with_minimax(Depth d, Value guess) const {
 
     stack[ply].ply          = ply;
     stack[ply].currentMove  = Move::none();
@@ -787,33 +1462,57 @@ Value MonteCarlo::evaluate_with_minimax(mctsNodeInfo* node, Depth d) const {
 
     constexpr auto delta = static_cast<Value>(18);
 
-    Value alpha;
-    Value beta;
+    const Value alpha = std::max(guess - delta, -VALUE_INFINITE);
+    const Value beta  = std::min(guess + delta, VALUE_INFINITE);
+
+    return thisThread->minimax_value(pos, &stack[ply], d, alpha, beta);
+}
+
+Value MonteCarlo::evaluate_with_minimax(mctsNodeInfo* node, Depth d) const {
+
+    Value guess;
 
     {
         LOCK(this, node);
-
-        alpha = std::max(node->ttValue - delta, -VALUE_INFINITE);
-        beta  = std::min(node->ttValue + delta, VALUE_INFINITE);
+        guess = node->ttValue;
     }
 
-    return thisThread->minimax_value(pos, &stack[ply], d, alpha, beta);
+    return evaluate_with_minimax(d, guess);
 }
 
-/// MonteCarlo::calculate_prior() returns the a-priori reward of the move leading to
-/// the n-th son of the current node. Here we use the evaluation function to
-/// estimate this prior, we could use other strategies too (like the rank n of
-/// the son, or the type of the move (good capture/quiet/bad capture), etc).
-Reward MonteCarlo::calculate_prior(const Move m) {
+/// MonteCarlo::calculate_priors() sets the a-priori rewards of the n moves of the
+/// list, which lead to the sons of the current node. Here we use the evaluation
+/// function to estimate the priors, we could use other strategies too (like the
+/// rank of the son, or the type of the move (good capture/quiet/bad capture), etc).
+/// The sons are evaluated in one batch, in the order of the move picker, so that
+/// each mini-search benefits from the TT entries and the histories filled by the
+/// previous ones, and a son whose exact value is already in the TT at a sufficient
+/// depth is not searched again.
+void MonteCarlo::calculate_priors(MovePrior* list, int n) {
+
+    for (int k = 0; k < n; k++)
+    {
+        const Move  m     = list[k].move;
+        const Depth depth = ply <= 2 || pos.capture(m) || pos.gives_check(m)
+                            ? PRIOR_SLOW_EVAL_DEPTH
+                            : PRIOR_FAST_EVAL_DEPTH;
+
+        stack[ply].moveCount = k + 1;
 
-    const Depth depth = ply <= 2 || pos.capture(m) || pos.gives_check(m) ? PRIOR_SLOW_EVAL_DEPTH
-                                                                         : PRIOR_FAST_EVAL_DEPTH;
+        do_move(m);
+
+        auto [ttHit, ttData, ttWriter] = tt.probe(pos.key());
 
-    do_move(m);
-    const Reward prior = value_to_reward(-evaluate_with_minimax(depth));
-    undo_move();
+        // Mate and TB values depend on the ply: we don't reuse them
+        const bool  ttUsable = ttHit && is_valid(ttData.value) && !is_decisive(ttData.value);
+        const Value value    = ttUsable && ttData.bound == BOUND_EXACT && ttData.depth >= depth
+                               ? ttData.value
+                               : evaluate_with_minimax(depth);
 
-    return prior;
+        undo_move();
+
+        list[k].prior = value_to_reward(-value);
+    }
 }
 
 /// MonteCarlo::value_to_reward() transforms a Alexander value to a reward in [0..1].
@@ -861,15 +1560,16 @@ double MonteCarlo::exploration_constant() const { return UCB_EXPLORATION_CONSTAN
 double MonteCarlo::ucb(const Edge* edge, long fatherVisits, bool priorMode) const {
 
     if (priorMode)
-        return edge->prior;
+        return edge->prior();
 
     assert(fatherVisits > 0);
 
+    const double visits = edge->visits();
+
     double result = 0.0;
-    if (((mctsThreads > 1) && (edge->visits > mctsMultiMinVisits))
-        || ((mctsThreads == 1) && edge->visits))
+    if (((mctsThreads > 1) && (visits > mctsMultiMinVisits)) || ((mctsThreads == 1) && visits))
     {
-        result += edge->meanActionValue;
+        result += edge->mean_action_value();
     }
     else
     {
@@ -878,11 +1578,10 @@ double MonteCarlo::ucb(const Edge* edge, long fatherVisits, bool priorMode) cons
 
     const double C =
       UCB_USE_FATHER_VISITS ? exploration_constant() * sqrt(fatherVisits) : exploration_constant();
-    const double losses = edge->visits - edge->actionValue;
-    const double visits = edge->visits;
+    const double losses = visits - edge->action_value();
 
     const double divisor = losses * UCB_LOSSES_AVOIDANCE + visits * (1.0 - UCB_LOSSES_AVOIDANCE);
-    result += C * edge->prior / (1 + divisor);
+    result += C * edge->prior() / (1 + divisor);
 
     result += UCB_LOG_TERM_FACTOR * sqrt(log(fatherVisits) / (1 + visits));
 
@@ -906,21 +1605,27 @@ void MonteCarlo::default_parameters() {
 /// standard output stream, as requested by the UCI protocol.
 void MonteCarlo::print_children() {
 
+    if (root == nullptr)
+        return;
+
     LOCK(this, root);
-    EdgeArray& children = root->children;
+    EdgeArray children;
 
     // Sort the moves according to their prior value
-    if (const int n = root->number_of_sons; n > 0)
-        std::sort(children.begin(), children.begin() + n, CompareRobustChoice);
+    const int n = root->number_of_sons;
+    for (int k = 0; k < n; k++)
+        children[k] = &root->children[k];
+
+    std::sort(children.begin(), children.begin() + n, CompareRobustChoice);
 
     for (int k = root->number_of_sons - 1; k >= 0; k--)
     {
         std::cout << "info string move " << k + 1 << " "
                   << UCIEngine::move(children[k]->move, pos.is_chess960())
 
-                  << std::setprecision(2) << " win% " << children[k]->prior * 100
+                  << std::setprecision(2) << " win% " << children[k]->prior() * 100
 
-                  << std::fixed << std::setprecision(0) << " visits " << children[k]->visits
+                  << std::fixed << std::setprecision(0) << " visits " << children[k]->visits()
                   << std::endl;
     }
 
@@ -19,8 +19,13 @@
 #ifndef MONTECARLO_H_INCLUDED
 #define MONTECARLO_H_INCLUDED
 
+#include <algorithm>
+#include <atomic>
 #include <cmath>
-#include <unordered_map>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
 
 #include "../movepick.h"
 #include "../position.h"
@@ -43,31 +48,69 @@ enum EdgeStatistic {
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////
-/// Edge struct stores the statistics of one edge between nodes in the Monte-Carlo tree
+/// Edge struct stores the statistics of one edge between nodes in the Monte-Carlo tree.
+/// The edges of a node are stored contiguously in the edge arena of the MCTS table, so
+/// we keep them small. The statistics are integers, updated with fetch_add() only, so
+/// that concurrent backups never retry nor lose an update: the sum of the rewards is
+/// a 64-bit fixed-point number, and the mean action value is derived from it on read.
 ///////////////////////////////////////////////////////////////////////////////////////
 struct Edge {
-    //Default constructor
-    Edge() :
-        move(Move::none()),
-        visits(0),
-        prior(REWARD_NONE),
-        actionValue(REWARD_NONE),
-        meanActionValue(REWARD_NONE) {}
+    static constexpr double REWARD_SCALE = double(1ULL << 30);  // Fixed-point REWARD_MATE
+    static constexpr double PRIOR_SCALE  = 65535.0;             // Fixed-point prior of 1.0
+
+    //Constructors
+    Edge() = default;
+    Edge(Move m, Reward p) :
+        move(m),
+        priorValue(to_prior(p)) {}
 
     //Prevent copying of this struct type
     Edge(const Edge&)            = delete;
     Edge& operator=(const Edge&) = delete;
 
-    std::atomic<Move>   move;
-    std::atomic<double> visits;
-    std::atomic<Reward> prior;
-    std::atomic<Reward> actionValue;
-    std::atomic<Reward> meanActionValue;
+    double visits() const { return visitCount.load(std::memory_order_relaxed); }
+    Reward prior() const { return priorValue.load(std::memory_order_relaxed) / PRIOR_SCALE; }
+    Reward action_value() const {
+        return rewardSum.load(std::memory_order_relaxed) / REWARD_SCALE;
+    }
+    Reward mean_action_value() const {
+        const double n = visits();
+        return n > 0 ? std::min(action_value() / n, 1.0) : 0.0;
+    }
+
+    void set_prior(Reward r) { priorValue.store(to_prior(r), std::memory_order_relaxed); }
+
+    // Add n visits without any reward (a virtual loss)
+    void add_virtual_loss(int n) { visitCount.fetch_add(uint32_t(n), std::memory_order_relaxed); }
+
+    // Replace the n visits of a virtual loss by one visit with the reward r
+    void add_reward(Reward r, int n) {
+        rewardSum.fetch_add(uint64_t(r * REWARD_SCALE + 0.5), std::memory_order_relaxed);
+        visitCount.fetch_add(uint32_t(1 - n), std::memory_order_relaxed);
+    }
+
+    Move move = Move::none();
+
+   private:
+    static uint16_t to_prior(Reward r) { return uint16_t(r * PRIOR_SCALE + 0.5); }
+
+    std::atomic<uint16_t> priorValue = 0;
+    std::atomic<uint32_t> visitCount = 0;  // Number of visits, including virtual losses
+    std::atomic<uint64_t> rewardSum  = 0;  // Sum of the rewards of the visits
+};
+
+static_assert(sizeof(Edge) == 16, "Unexpected Edge size");
+
+// A move of a node being expanded, with its prior
+struct MovePrior {
+    Move   move;
+    Reward prior;
 };
 
 extern size_t                           mctsThreads;
 extern size_t                           mctsMultiStrategy;
 extern double                           mctsMultiMinVisits;
+extern int                              mctsVirtualLoss;
 constexpr int                           MAX_CHILDREN = MAX_MOVES;
 typedef std::array<Edge*, MAX_CHILDREN> EdgeArray;
 
@@ -126,15 +169,7 @@ class Spinlock {
 struct mctsNodeInfo {
 
     //Default constructor
-    mctsNodeInfo() {
-        for (size_t i = 0; i < children.size(); ++i)
-            children[i] = new Edge();
-    }
-
-    ~mctsNodeInfo() {
-        for (size_t i = 0; i < children.size(); ++i)
-            delete children[i];
-    }
+    mctsNodeInfo() = default;
 
     //Prevent copying of this struct type
     mctsNodeInfo(const mctsNodeInfo&)            = delete;
@@ -143,42 +178,108 @@ struct mctsNodeInfo {
     Spinlock lock;
 
     // Data members
-    Key                key1           = 0;  // Zobrist hash of all pieces, including pawns
-    Key                key2           = 0;  // Zobrist hash of pawns
-    std::atomic<long>  node_visits    = 0;  // number of visits by the Monte-Carlo algorithm
-    std::atomic<int>   number_of_sons = 0;  // total number of legal moves
-    std::atomic<Move>  lastMove       = Move::none();  // the move between the parent and this node
-    std::atomic<Value> ttValue        = VALUE_NONE;
-    std::atomic<bool>  AB             = false;
-    EdgeArray          children;
+    Key                  key1           = 0;  // Zobrist hash of all pieces, including pawns
+    Key                  key2           = 0;  // Zobrist hash of pawns
+    std::atomic<long>    node_visits    = 0;  // number of visits by the Monte-Carlo algorithm
+    std::atomic<int>     number_of_sons = 0;  // total number of legal moves
+    std::atomic<Move>    lastMove       = Move::none();  // the move from the parent to this node
+    std::atomic<Value>   ttValue        = VALUE_NONE;
+    std::atomic<bool>    AB             = false;
+    std::atomic<uint8_t> generation     = 0;  // the last search which visited this node
+    Edge*                children       = nullptr;  // number_of_sons edges, in the edge arena
 };
 
-class MonteCarlo;
-mctsNodeInfo* get_node(const MonteCarlo* mcts, const Position& pos);
+mctsNodeInfo* get_node(const Position& pos);
+void          backup_benchmark(int maxThreads, TimePoint millis);
 
 ///////////////////////////////////////////////////////////////////////////////////////
-// The Monte-Carlo tree is stored implicitly in one big hash table
+// The Monte-Carlo tree is stored implicitly in one big hash table. The table is an
+// open-addressing array of cache-line sized buckets, mapping position keys to the
+// nodes of a preallocated node pool, and the edges of each node are carved out of an
+// edge arena. All these arrays are allocated once, in large pages.
+// Lookups and inserts are lock-free: a thread claims an empty slot with a CAS on the
+// key, constructs the node in the pool and then publishes its index in the slot.
 ///////////////////////////////////////////////////////////////////////////////////////
-typedef std::unordered_multimap<Key, mctsNodeInfo*> MCTS_MAP_BASE;
-extern std::atomic<size_t>                          MCTSNodeCount;
-class MCTSHashTable: public MCTS_MAP_BASE {
-   public:
-    ~MCTSHashTable() { clear(); }
+struct MCTSSlot {
+    std::atomic<Key>      key1;   // Zobrist hash of the position, 0 for an empty slot
+    std::atomic<uint32_t> index;  // Index of the node in the pool, once published
+};
 
-    void clear() {
-        for (unsigned i = 0; i < bucket_count(); ++i)
-        {
-            for (auto it = begin(i); it != end(i); ++it)
-                delete it->second;
-        }
+constexpr int MCTSBucketSize = 4;
 
-        MCTS_MAP_BASE::clear();
-        MCTSNodeCount = 0;
-    }
+struct alignas(64) MCTSBucket {
+    MCTSSlot slot[MCTSBucketSize];
 };
+
+static_assert(sizeof(MCTSBucket) == 64, "Suboptimal MCTSBucket size");
+
+extern std::atomic<size_t> MCTSNodeCount;
+extern std::atomic<size_t> MCTSPlayouts;
+extern std::atomic<size_t> MCTSExpansions;
+
+class MCTSHashTable {
+   public:
+    ~MCTSHashTable() { free(); }
+
+    void          reserve(size_t mbSize);  // Allocate mbSize MB for the tree, if not done yet
+    void          clear();                 // Destroy all the nodes, not thread safe
+    void          new_search() { ++generation; }
+    void          promote_root(Position& rootPos);  // Release the nodes out of its subtree
+    long          reused_visits() const { return reusedVisits; }
+    mctsNodeInfo* find_or_insert(Key key1, Key key2);
+    Edge*         allocate_edges(int n);  // Returns nullptr when the edge arena is full
+    size_t        capacity() const { return nodeCapacity; }
+    int           hashfull() const;
+
+    // Snapshots of the tree on disk, and statistics for offline inspection. These
+    // functions must not be called while a search is running.
+    bool        save(const std::string& fileName) const;
+    bool        load(const std::string& fileName);
+    std::string stats(const Position& rootPos) const;
+
+    // When the tree is full, the cold part of the tree is recycled. This is done
+    // at a safepoint, once every thread searching the tree holds no node.
+    void enter_search();
+    void leave_search();
+    bool is_full() const { return full.load(std::memory_order_relaxed); }
+    void recycle_at_safepoint();
+
+   private:
+    static constexpr uint32_t NO_INDEX   = 0xFFFFFFFF;  // Slot claimed, node not published yet
+    static constexpr uint32_t FULL_INDEX = 0xFFFFFFFE;  // Slot claimed, but the pool was full
+    static constexpr size_t   MAX_PROBES = 8;           // Buckets probed before giving up
+
+    void          free();
+    void          recycle();
+    mctsNodeInfo* find(Key key1, Key key2) const;
+    void          rebuild_index(size_t count);
+    void          mark_subtree(Position& pos, mctsNodeInfo* node, int depth);
+
+    template<typename Predicate>
+    void compact(Predicate keep);
+
+    MCTSBucket*   buckets      = nullptr;
+    mctsNodeInfo* nodePool     = nullptr;
+    Edge*         edgePool     = nullptr;
+    size_t        bucketCount  = 0;
+    size_t        nodeCapacity = 0;
+    size_t        edgeCapacity = 0;
+    size_t        mbCapacity   = 0;
+    uint8_t       generation   = 0;
+    long          reusedVisits = 0;  // Visits of the root carried over by promote_root()
+
+    std::atomic<size_t> edgeCount = 0;
+    std::atomic<bool>   full      = false;
+
+    std::mutex              recycleMutex;
+    std::condition_variable recycleCondition;
+    size_t                  activeSearches = 0;
+    size_t                  parkedSearches = 0;
+    uint64_t                recycleEpoch   = 0;
+};
+
 extern MCTSHashTable MCTS;
-extern MCTSHashTable MCTS;
-const size_t         MCTSMaxNodes = 100000;
+const size_t         MCTSEdgesPerNode = 48;  // Average size of the edge arena per node
 
 ///////////////////////////////////////////////////////////////////////////////////////
 // Main MCTS search class
@@ -189,6 +290,7 @@ class MonteCarlo {
    public:
     // Constructors
     MonteCarlo(Position& p, Search::Worker* worker, TranspositionTable& transpositionTable);
+    ~MonteCarlo();
 
     //Prevent copying of this class type
     MonteCarlo(const MonteCarlo&)            = delete;
@@ -202,6 +304,7 @@ class MonteCarlo {
 
     // The high-level description of the Monte-Carlo algorithm
     void create_root(Search::Worker* worker);
+    bool recycle_tree();
     bool computational_budget(Alexander::ThreadPool& threads, Alexander::Search::LimitsType limits);
     mctsNodeInfo* tree_policy(Alexander::ThreadPool& threads, Alexander::Search::LimitsType limits);
     Reward        playout_policy(mctsNodeInfo* node);
@@ -222,10 +325,10 @@ class MonteCarlo {
     [[nodiscard]] Reward value_to_reward(Value v) const;
     [[nodiscard]] Value  reward_to_value(Reward r) const;
     [[nodiscard]] Value  evaluate_with_minimax(Depth d) const;
+    [[nodiscard]] Value  evaluate_with_minimax(Depth d, Value guess) const;
     Value                evaluate_with_minimax(mctsNodeInfo* node, Depth d) const;
     [[nodiscard]] Reward evaluate_terminal(mctsNodeInfo* node) const;
-    Reward               calculate_prior(Move m);
-    void                 add_prior_to_node(mctsNodeInfo* node, Move m, Reward prior) const;
+    void                 calculate_priors(MovePrior* list, int n);
 
     // Tweaking the exploration algorithm
     void                 default_parameters();
@@ -19,6 +19,9 @@
 #include "memory.h"
 
 #include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <string>
 
 #if __has_include("features.h")
     #include <features.h>
@@ -175,6 +178,42 @@ bool has_large_pages() {
 }
 
 
+// available_memory() returns the physical memory available to new allocations,
+// without swapping, or 0 if it is unknown.
+
+size_t available_memory() {
+
+#if defined(_WIN32)
+
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof(status);
+
+    return GlobalMemoryStatusEx(&status) ? size_t(status.ullAvailPhys) : 0;
+
+#elif defined(__linux__)
+
+    std::ifstream meminfo("/proc/meminfo");
+    std::string   name;
+    size_t        kB;
+
+    while (meminfo >> name >> kB)
+    {
+        if (name == "MemAvailable:")
+            return kB * 1024;
+
+        meminfo.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    }
+
+    return 0;
+
+#else
+
+    return 0;
+
+#endif
+}
+
+
 // aligned_large_pages_free() will free the previously memory allocated
 // by aligned_large_pages_alloc(). The effect is a nop if mem == nullptr.
 
@@ -70,6 +70,8 @@ void  aligned_large_pages_free(void* mem);
 
 bool has_large_pages();
 
+size_t available_memory();
+
 // Frees memory which was placed there with placement new.
 // Works for both single objects and arrays of unknown bound.
 template<typename T, typename FREE_FUNC>
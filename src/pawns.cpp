@@ -18,8 +18,12 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
 
 #include "bitboard.h"
+#include "memory.h"
 #include "pawns.h"
 #include "position.h"
 #include "thread.h"
@@ -191,17 +195,77 @@ ScoreForClassical evaluate(const Position& pos, Pawns::Entry* e) {
 namespace Pawns {
 
 
+namespace {
+
+// The checksum of the data of an entry, that is of the words following its key
+Key checksum(const Entry& e) {
+    static_assert(sizeof(Entry) % sizeof(Key) == 0 && offsetof(Entry, key) == 0);
+
+    Key words[sizeof(Entry) / sizeof(Key)];
+    std::memcpy(words, &e, sizeof(Entry));
+
+    Key sum = 0;
+    for (size_t i = 1; i < sizeof(Entry) / sizeof(Key); ++i)
+        sum ^= words[i] * (2 * i + 1);
+
+    return sum;
+}
+
+}  // namespace
+
+Table::~Table() { aligned_large_pages_free(table); }
+
+/// Table::resize() sets the size of the table to the largest power of two of entries
+/// fitting in mbSize megabytes. The calling thread zeroes it, so that its pages are
+/// allocated on the NUMA node of the thread.
+
+void Table::resize(size_t mbSize) {
+    aligned_large_pages_free(table);
+
+    count = size_t(1) << msb(mbSize * 1024 * 1024 / sizeof(Entry));
+    table = static_cast<Entry*>(aligned_large_pages_alloc(count * sizeof(Entry)));
+
+    if (!table)
+    {
+        std::cerr << "Failed to allocate " << mbSize << "MB for pawn hash table." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    std::memset(static_cast<void*>(table), 0, count * sizeof(Entry));
+}
+
+/// Table::probe() copies the entry of the given key, and returns false if there is none
+
+bool Table::probe(Key key, Entry& e) const {
+    std::memcpy(static_cast<void*>(&e), &table[key & (count - 1)], sizeof(Entry));
+
+    if ((e.key ^ checksum(e)) != key)
+        return false;
+
+    e.key = key;
+    return true;
+}
+
+void Table::store(const Entry& e) {
+    Entry& slot = table[e.key & (count - 1)];
+
+    std::memcpy(static_cast<void*>(&slot), &e, sizeof(Entry));
+    slot.key ^= checksum(e);
+}
+
+
 /// Pawns::probe() looks up the current position's pawns configuration in
-/// the pawns hash table. It returns a pointer to the Entry if the position
-/// is found. Otherwise a new Entry is computed and stored there, so we don't
-/// have to recompute all when the same pawns configuration occurs again.
+/// the pawns hash table. It returns a pointer to the Entry of the thread, which
+/// is copied from the table if the position is found. Otherwise a new Entry is
+/// computed and stored there, so we don't have to recompute all when the same
+/// pawns configuration occurs again.
 
 Entry* probe(const Position& pos) {
 
     Key    key = pos.pawn_key();
-    Entry* e   = pos.this_thread()->pawnsTable[key];
+    Entry* e   = &pos.this_thread()->pawnsEntry;
 
-    if (e->key == key)
+    if (e->key == key || pos.this_thread()->worker->pawnsTable.probe(key, *e))
         return e;
 
     e->key           = key;
@@ -209,6 +273,8 @@ Entry* probe(const Position& pos) {
     e->scores[WHITE] = evaluate<WHITE>(pos, e);
     e->scores[BLACK] = evaluate<BLACK>(pos, e);
 
+    pos.this_thread()->worker->pawnsTable.store(*e);
+
     return e;
 }
 
@@ -19,6 +19,8 @@
 #ifndef PAWNS_H_INCLUDED
 #define PAWNS_H_INCLUDED
 
+#include <cstddef>
+
 #include "misc.h"
 #include "position.h"
 #include "types.h"
@@ -63,7 +65,26 @@ struct Entry {
     int               blockedCount;
 };
 
-using Table = HashTable<Entry, 131072>;
+/// Pawns::Table is the pawn hash table, shared by the threads of a NUMA node and
+/// allocated on its memory, with large pages if possible. The entries are copied
+/// without locks: an entry is stored with its key xored with a checksum of its data,
+/// so that a copy torn by a concurrent store doesn't match its key.
+
+class Table {
+   public:
+    Table() = default;
+    ~Table();
+    Table(const Table&)            = delete;
+    Table& operator=(const Table&) = delete;
+
+    void resize(size_t mbSize);
+    bool probe(Key key, Entry& e) const;
+    void store(const Entry& e);
+
+   private:
+    Entry* table = nullptr;
+    size_t count = 0;
+};
 
 Entry* probe(const Position& pos);
 
@@ -1169,7 +1169,10 @@ void Position::set_state() const {
     st->materialKey = compute_material_key();
 }
 
-Key Position::compute_material_key() const {
+Key Position::compute_material_key() const { return material_key(pieceCount); }
+
+// Returns the material key of the given numbers of pieces, indexed by piece
+Key Position::material_key(const int pieceCount[PIECE_NB]) {
     Key k = 0;
     for (Piece pc : Pieces)
         for (int cnt = 0; cnt < pieceCount[pc]; ++cnt)
@@ -1533,8 +1536,9 @@ void Position::do_move(Move                      m,
     // ones which are going to be recalculated from scratch anyway and then switch
     // our state pointer to point to the new (ready to be updated) state.
     std::memcpy(&newSt, st, offsetof(StateInfo, key));
-    newSt.previous = st;
-    st             = &newSt;
+    newSt.previous     = st;
+    newSt.attacksValid = false;
+    st                 = &newSt;
 
     // Increment ply counters. In particular, rule50 will be reset to zero later on
     // in case of a capture or a pawn move.
@@ -1555,6 +1559,8 @@ void Position::do_move(Move                      m,
     assert(captured == NO_PIECE || color_of(captured) == (m.type_of() != CASTLING ? them : us));
     assert(type_of(captured) != KING);
 
+    st->dirtySquares = square_bb(from) | to;
+
     if (m.type_of() == CASTLING)
     {
         assert(pc == make_piece(us, KING));
@@ -1562,6 +1568,7 @@ void Position::do_move(Move                      m,
 
         Square rfrom, rto;
         do_castling<true>(us, from, to, rfrom, rto);  //for classical
+        st->dirtySquares |= square_bb(to) | rto;
 
         k ^= Zobrist::psq[captured][rfrom] ^ Zobrist::psq[captured][rto];
         st->nonPawnKey[us] ^= Zobrist::psq[captured][rfrom] ^ Zobrist::psq[captured][rto];
@@ -1587,6 +1594,7 @@ void Position::do_move(Move                      m,
 
                 // Update board and piece lists in ep case, normal captures are updated later
                 remove_piece(capsq);
+                st->dirtySquares |= capsq;
             }
 
             st->pawnKey ^= Zobrist::psq[captured][capsq];
@@ -1605,7 +1613,6 @@ void Position::do_move(Move                      m,
         k ^= Zobrist::psq[captured][capsq];
         st->materialKey ^=
           Zobrist::psq[captured][8 + pieceCount[captured] - (m.type_of() != EN_PASSANT)];
-        prefetch(thisThread->materialTable[st->materialKey]);  //for classical
         // Reset rule 50 counter
         st->rule50 = 0;
     }
@@ -1766,7 +1773,10 @@ void Position::do_move(Move                      m,
     // Update the key with the final value
     st->key = k;
     if (tt)
+    {
         prefetch(tt->first_entry(key()));
+        prefetch(thisThread->worker->evalCache.entry(key() ^ Eval::handicapConfig.evalKey));
+    }
 
     // Calculate the repetition info. It is the ply distance from the previous
     // occurrence of the same position, negative in the 3-fold case, or zero
@@ -1876,6 +1886,49 @@ void Position::do_castling(
 }
 
 
+// Brings the attacks of the pieces up to date. When those of the previous position
+// are known, they are copied, and only the pieces on the squares changed by the move
+// and the sliders whose attacks reached one of these squares are recomputed.
+void Position::update_piece_attacks() const {
+    const StateInfo* prev  = st->previous;
+    Bitboard         stale = AllSquares;
+
+    if (prev && prev->attacksValid)
+    {
+        std::memcpy(st->pieceAttacks, prev->pieceAttacks, sizeof(st->pieceAttacks));
+
+        stale            = st->dirtySquares;
+        Bitboard sliders = pieces(BISHOP, ROOK, QUEEN) & ~stale;
+
+        while (sliders)
+        {
+            Square s = pop_lsb(sliders);
+            if (prev->pieceAttacks[s] & st->dirtySquares)
+                stale |= s;
+        }
+    }
+
+    const Bitboard occupied = pieces();
+    const Bitboard xrayed   = occupied ^ pieces(QUEEN);
+    Bitboard       b        = pieces(KNIGHT, BISHOP, ROOK, QUEEN) & stale;
+
+    while (b)
+    {
+        Square s  = pop_lsb(b);
+        Piece  pc = piece_on(s);
+
+        st->pieceAttacks[s] =
+          type_of(pc) == KNIGHT ? attacks_bb<KNIGHT>(s)
+          : type_of(pc) == BISHOP
+            ? attacks_bb<BISHOP>(s, xrayed)
+          : type_of(pc) == ROOK ? attacks_bb<ROOK>(s, xrayed ^ pieces(color_of(pc), ROOK))
+                                : attacks_bb<QUEEN>(s, occupied);
+    }
+
+    st->attacksValid = true;
+}
+
+
 // Used to do a "null move": it flips
 // the side to move without executing any move on the board.
 void Position::do_null_move(StateInfo& newSt, const TranspositionTable& tt) {
@@ -1883,10 +1936,12 @@ void Position::do_null_move(StateInfo& newSt, const TranspositionTable& tt) {
     assert(!checkers());
     assert(&newSt != st);
 
-    std::memcpy(&newSt, st, sizeof(StateInfo));
+    std::memcpy(&newSt, st, offsetof(StateInfo, pieceAttacks));
 
-    newSt.previous = st;
-    st             = &newSt;
+    newSt.previous     = st;
+    newSt.dirtySquares = 0;
+    newSt.attacksValid = false;
+    st                 = &newSt;
 
     if (st->epSquare != SQ_NONE)
     {
@@ -65,6 +65,13 @@ struct StateInfo {
     Bitboard   checkSquares[PIECE_TYPE_NB];
     Piece      capturedPiece;
     int        repetition;
+
+    // The attacks of the knights, bishops, rooks and queens by square, brought up to
+    // date on demand from those of the previous position, where dirtySquares changed.
+    // They are last, so that a null move doesn't copy them.
+    Bitboard dirtySquares;
+    bool     attacksValid;
+    Bitboard pieceAttacks[SQUARE_NB];
 };
 
 
@@ -133,6 +140,7 @@ class Position {
     Bitboard slider_blockers(Bitboard sliders, Square s, Bitboard& pinners) const;  //for classical
     template<PieceType Pt>
     Bitboard attacks_by(Color c) const;
+    Bitboard piece_attacks(Square s) const;
 
     // Properties of moves
     bool  legal(Move m) const;
@@ -165,6 +173,7 @@ class Position {
     // Accessing hash keys
     Key key() const;
     Key material_key() const;
+    static Key material_key(const int pieceCount[PIECE_NB]);
     Key pawn_key() const;
     Key minor_piece_key() const;
     Key non_pawn_key(Color c) const;
@@ -202,6 +211,7 @@ class Position {
     Key  compute_material_key() const;
     void set_state() const;
     void set_check_info() const;
+    void update_piece_attacks() const;
 
     // Other helpers
     template<bool PutPiece, bool ComputeRay = true>
@@ -318,6 +328,17 @@ inline Bitboard Position::attacks_by(Color c) const {
     }
 }
 
+// Returns the attacks of the knight, bishop, rook or queen on the given square, as
+// seen by the evaluation: bishops x-ray the queens, rooks the queens and their rooks.
+inline Bitboard Position::piece_attacks(Square s) const {
+    assert(type_of(piece_on(s)) >= KNIGHT && type_of(piece_on(s)) <= QUEEN);
+
+    if (!st->attacksValid)
+        update_piece_attacks();
+
+    return st->pieceAttacks[s];
+}
+
 inline Bitboard Position::checkers() const { return st->checkersBB; }
 
 inline Bitboard Position::blockers_for_king(Color c) const { return st->blockersForKing[c]; }
@@ -42,6 +42,7 @@ Local assessments: Penalize or reward based on king's security, tactical complex
 #include <list>
 #include <ratio>
 #include <string>
+#include <unordered_set>
 #include <utility>
 
 #include "bitboard.h"
@@ -182,6 +183,49 @@ bool is_shuffling(Move move, Stack* const ss, const Position& pos) {
         && (ss - 2)->currentMove.from_sq() == (ss - 4)->currentMove.to_sq();
 }
 
+//learning begin
+constexpr size_t MaxSeededPositions = 1 << 16;
+
+// Writes the best experience move of the positions reached from pos along the
+// experience moves, up to maxPly, to the transposition table, so that the search
+// tries the known lines first. Only the move is seeded: the experience depth and
+// score, written as exact entries, trigger singular extensions and less reductions
+// along the seeded lines, which costs more nodes than the cutoffs save. The entries
+// searched at least as deep as the experience are kept.
+void seed_tt(Position&                pos,
+             TranspositionTable&      tt,
+             int                      ply,
+             int                      maxPly,
+             std::unordered_set<Key>& seeded) {
+    if (ply > maxPly || seeded.size() >= MaxSeededPositions || !seeded.insert(pos.key()).second)
+        return;
+
+    std::vector<LearningMove> learningMoves = LD.probe(pos.key());
+    if (learningMoves.empty())
+        return;
+
+    LD.sortLearningMoves(learningMoves);
+
+    const LearningMove& best = learningMoves[0];
+    if (pos.pseudo_legal(best.move) && pos.legal(best.move))
+    {
+        auto [ttHit, ttData, ttWriter] = tt.probe(pos.key());
+        if (!ttHit || ttData.depth < best.depth)
+            ttWriter.write(pos.key(), VALUE_NONE, false, BOUND_NONE, DEPTH_UNSEARCHED, best.move,
+                           VALUE_NONE, tt.generation());
+    }
+
+    StateInfo st;
+    for (const LearningMove& learningMove : learningMoves)
+        if (pos.pseudo_legal(learningMove.move) && pos.legal(learningMove.move))
+        {
+            pos.do_move(learningMove.move, st, &tt);
+            seed_tt(pos, tt, ply + 1, maxPly, seeded);
+            pos.undo_move(learningMove.move);
+        }
+}
+//learning end
+
 }  // namespace
 
 
@@ -371,6 +415,8 @@ Search::Worker::Worker(SharedState&                    sharedState,
     //mcts begin
     threadIdx(threadId),
     sharedHistory(sharedState.sharedHistories.at(token.get_numa_index())),
+    evalCache(sharedState.evalCaches.at(token.get_numa_index())),
+    pawnsTable(sharedState.pawnsTables.at(token.get_numa_index())),
     //mcts end
     numaThreadIdx(numaThreadId),
     numaTotal(numaTotalThreads),
@@ -440,24 +486,24 @@ void Search::Worker::start_searching() {
                 && rootPos.game_ply() / 2 < (int) options["Experience Book Max Moves"])
             {
                 Depth expBookMinDepth = (Depth) options["Experience Book Min Depth"];
-                std::vector<LearningMove*> learningMoves = LD.probe(rootPos.key());
+                std::vector<LearningMove> learningMoves = LD.probe(rootPos.key());
                 if (!learningMoves.empty())
                 {
                     LD.sortLearningMoves(learningMoves);
-                    std::vector<LearningMove*> bestMoves;
-                    Depth                      bestDepth = learningMoves[0]->depth;
+                    std::vector<const LearningMove*> bestMoves;
+                    Depth                            bestDepth = learningMoves[0].depth;
                     if (bestDepth >= expBookMinDepth)
                     {
-                        int   bestPerformance = learningMoves[0]->performance;
-                        Value bestScore       = learningMoves[0]->score;
+                        int   bestPerformance = learningMoves[0].performance;
+                        Value bestScore       = learningMoves[0].score;
                         if (bestPerformance >= 50)
                         {
                             for (const auto& move : learningMoves)
                             {
-                                if (move->depth == bestDepth && move->performance == bestPerformance
-                                    && move->score == bestScore)
+                                if (move.depth == bestDepth && move.performance == bestPerformance
+                                    && move.score == bestScore)
                                 {
-                                    bestMoves.push_back(move);
+                                    bestMoves.push_back(&move);
                                 }
                                 else
                                 {
@@ -583,6 +629,20 @@ void Search::Worker::start_searching() {
             mctsThreads        = size_t(int(options["MCTSThreads"]));
             mctsMultiStrategy  = size_t(int(options["MCTS Multi Strategy"]));
             mctsMultiMinVisits = double(int(options["MCTS Multi MinVisits"]));
+            mctsVirtualLoss    = int(options["MCTS Virtual Loss"]);
+            if (bool(options["MCTS by Shashin"]))
+            {
+                MCTS.reserve(size_t(int(options["MCTS Hash"])));
+                MCTS.new_search();
+                MCTS.promote_root(rootPos);  // Reuse the tree of the previous moves
+            }
+
+            //Seed the transposition table with the experience of the known lines
+            if (int(options["Experience TT Seeding Plies"]) > 0)
+            {
+                std::unordered_set<Key> seeded;
+                seed_tt(rootPos, tt, 0, int(options["Experience TT Seeding Plies"]) - 1, seeded);
+            }
 
             threads.start_searching();  // start non-main threads
             iterative_deepening();      // main thread start searching
@@ -638,9 +698,9 @@ void Search::Worker::start_searching() {
 
             if (LD.learning_mode() == LearningMode::Self)
             {
-                const LearningMove* existingMove = LD.probe_move(plm.key, plm.learningMove.move);
-                if (existingMove)
-                    plm.learningMove.score = existingMove->score;
+                LearningMove existingMove;
+                if (LD.probe_move(plm.key, plm.learningMove.move, existingMove))
+                    plm.learningMove.score = existingMove.score;
                 QLearningMove qLearningMove;
                 qLearningMove.persistedLearningMove = plm;
                 const int qLearningMoveMaterial =
@@ -1127,6 +1187,7 @@ void Search::Worker::clear() {
     // Each thread is responsible for clearing their part of shared history
     sharedHistory.correctionHistory.clear_range(0, numaThreadIdx, numaTotal);
     sharedHistory.pawnHistory.clear_range(-1238, numaThreadIdx, numaTotal);
+    evalCache.clear_range(numaThreadIdx, numaTotal);
 
     ttMoveHistory = 0;
 
@@ -1440,8 +1501,10 @@ Value Search::Worker::search(
 
     if (!excludedMove && LD.is_enabled() && useLearning)
     {
-        const LearningMove* learningMove = nullptr;
-        sibs                             = LD.probeByMaxDepthAndScore(posKey, learningMove);
+        LearningMove probedMove;
+        sibs = LD.probeByMaxDepthAndScore(posKey, probedMove);
+
+        const LearningMove* learningMove = sibs ? &probedMove : nullptr;
         if (learningMove)
         {
             assert(sibs);
@@ -2736,9 +2799,9 @@ Value Search::Worker::qsearch(Position& pos, Stack* ss, Value alpha, Value beta)
 
     if (useLearning && LD.is_enabled())
     {
-        const LearningMove* learningMove = nullptr;
-        int                 siblings     = LD.probeByMaxDepthAndScore(posKey, learningMove);
-        (void) siblings;
+        LearningMove        probedMove;
+        const int           siblings     = LD.probeByMaxDepthAndScore(posKey, probedMove);
+        const LearningMove* learningMove = siblings ? &probedMove : nullptr;
 
         if (learningMove)
         {
@@ -3633,6 +3696,7 @@ void SearchManager::pv(Search::Worker&           worker,
         info.tbHits    = tbHits;
         info.pv        = pv;
         info.hashfull  = tt.hashfull();
+        info.mctsfull  = bool(worker.options["MCTS by Shashin"]) ? MCTS.hashfull() : -1;
 
         updates.onUpdateFull(info);
     }
@@ -36,6 +36,7 @@
 #include "misc.h"
 //from classical
 #include "numa.h"
+#include "pawns.h"
 #include "position.h"
 #include "score.h"
 #include "syzygy/tbprobe.h"
@@ -151,12 +152,16 @@ struct SharedState {
                 ThreadPool&                           threadPool,
                 TranspositionTable&                   transpositionTable,
                 std::map<NumaIndex, SharedHistories>& sharedHists,
+                std::map<NumaIndex, Eval::Cache>&     evalCachesMap,
+                std::map<NumaIndex, Pawns::Table>&    pawnsTablesMap,
                 const Alexander::ShashinConfig&       shCfg) :
         bookMan(bm),
         options(optionsMap),
         threads(threadPool),
         tt(transpositionTable),
         sharedHistories(sharedHists),
+        evalCaches(evalCachesMap),
+        pawnsTables(pawnsTablesMap),
         shashinConfig(shCfg) {}  //shashin
     BookManager& bookMan;
     //from Polyfish end
@@ -164,6 +169,8 @@ struct SharedState {
     ThreadPool&                           threads;
     TranspositionTable&                   tt;
     std::map<NumaIndex, SharedHistories>& sharedHistories;
+    std::map<NumaIndex, Eval::Cache>&     evalCaches;
+    std::map<NumaIndex, Pawns::Table>&    pawnsTables;
     const Alexander::ShashinConfig        shashinConfig;  //Shashin
 };
 
@@ -193,6 +200,7 @@ struct InfoFull: InfoShort {
     size_t           tbHits;
     std::string_view pv;
     int              hashfull;
+    int              mctsfull = -1;  // MCTS tree occupation, -1 when MCTS is not used
 };
 
 struct InfoIteration {
@@ -291,6 +299,9 @@ class Worker {
 
     TTMoveHistory    ttMoveHistory;
     SharedHistories& sharedHistory;
+    Eval::Cache&     evalCache;
+    Pawns::Table&    pawnsTable;
+    uint64_t         evalCacheProbes = 0, evalCacheHits = 0;
     RootMoves        rootMoves;                          //mcts
     Depth            completedDepth;                     //mcts
     bool             nmpGuard = false, nmpSide = false;  //from Crystal-shashin
@@ -364,7 +375,7 @@ class Worker {
     //for classical
     //Shashin begin
     std::unique_ptr<ShashinManager> shashinManager;
-    const Alexander::ShashinConfig& shConfig;
+    const Alexander::ShashinConfig  shConfig;
     friend class Alexander::ThreadPool;
     //Shashin end
     friend class SearchManager;
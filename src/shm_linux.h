@@ -171,12 +171,19 @@ class SharedMemory: public detail::SharedMemoryBase {
     void*              mapped_ptr_ = nullptr;
     T*                 data_ptr_   = nullptr;
     detail::ShmHeader* header_ptr_ = nullptr;
+    size_t             count_      = 1;
     size_t             total_size_ = 0;
     std::string        sentinel_base_;
     std::string        sentinel_path_;
 
-    static constexpr size_t calculate_total_size() noexcept {
-        return sizeof(T) + sizeof(detail::ShmHeader);
+    // The header follows the elements, aligned for its mutex
+    static constexpr size_t calculate_data_size(size_t count) noexcept {
+        constexpr size_t alignment = alignof(detail::ShmHeader);
+        return (sizeof(T) * count + alignment - 1) / alignment * alignment;
+    }
+
+    static constexpr size_t calculate_total_size(size_t count) noexcept {
+        return calculate_data_size(count) + sizeof(detail::ShmHeader);
     }
 
     static std::string make_sentinel_base(const std::string& name) {
@@ -188,9 +195,11 @@ class SharedMemory: public detail::SharedMemoryBase {
     }
 
    public:
-    explicit SharedMemory(const std::string& name) noexcept :
+    // The region holds an array of count elements, a single object by default
+    explicit SharedMemory(const std::string& name, size_t count = 1) noexcept :
         name_(name),
-        total_size_(calculate_total_size()),
+        count_(count),
+        total_size_(calculate_total_size(count)),
         sentinel_base_(make_sentinel_base(name)) {}
 
     ~SharedMemory() noexcept override {
@@ -207,6 +216,7 @@ class SharedMemory: public detail::SharedMemoryBase {
         mapped_ptr_(other.mapped_ptr_),
         data_ptr_(other.data_ptr_),
         header_ptr_(other.header_ptr_),
+        count_(other.count_),
         total_size_(other.total_size_),
         sentinel_base_(std::move(other.sentinel_base_)),
         sentinel_path_(std::move(other.sentinel_path_)) {
@@ -227,6 +237,7 @@ class SharedMemory: public detail::SharedMemoryBase {
             mapped_ptr_    = other.mapped_ptr_;
             data_ptr_      = other.data_ptr_;
             header_ptr_    = other.header_ptr_;
+            count_         = other.count_;
             total_size_    = other.total_size_;
             sentinel_base_ = std::move(other.sentinel_base_);
             sentinel_path_ = std::move(other.sentinel_path_);
@@ -239,7 +250,10 @@ class SharedMemory: public detail::SharedMemoryBase {
         return *this;
     }
 
-    [[nodiscard]] bool open(const T& initial_value) noexcept {
+    [[nodiscard]] bool open(const T& initial_value) noexcept { return open(&initial_value); }
+
+    // Without an initial value, the elements of a new region are left to zero
+    [[nodiscard]] bool open(const T* initial_value) noexcept {
         detail::CleanupHooks::ensure_registered();
 
         bool retried_stale = false;
@@ -595,7 +609,7 @@ class SharedMemory: public detail::SharedMemoryBase {
         return found;
     }
 
-    [[nodiscard]] bool setup_new_region(const T& initial_value) noexcept {
+    [[nodiscard]] bool setup_new_region(const T* initial_value) noexcept {
         if (ftruncate(fd_, static_cast<off_t>(total_size_)) == -1)
             return false;
 
@@ -609,12 +623,13 @@ class SharedMemory: public detail::SharedMemoryBase {
             return false;
         }
 
-        data_ptr_ = static_cast<T*>(mapped_ptr_);
-        header_ptr_ =
-          reinterpret_cast<detail::ShmHeader*>(static_cast<char*>(mapped_ptr_) + sizeof(T));
+        data_ptr_   = static_cast<T*>(mapped_ptr_);
+        header_ptr_ = reinterpret_cast<detail::ShmHeader*>(static_cast<char*>(mapped_ptr_)
+                                                           + calculate_data_size(count_));
 
         new (header_ptr_) detail::ShmHeader{};
-        new (data_ptr_) T{initial_value};
+        if (initial_value)
+            new (data_ptr_) T{*initial_value};
 
         if (!initialize_shared_mutex())
             return false;
@@ -643,8 +658,8 @@ class SharedMemory: public detail::SharedMemoryBase {
         }
 
         data_ptr_   = static_cast<T*>(mapped_ptr_);
-        header_ptr_ = std::launder(
-          reinterpret_cast<detail::ShmHeader*>(static_cast<char*>(mapped_ptr_) + sizeof(T)));
+        header_ptr_ = std::launder(reinterpret_cast<detail::ShmHeader*>(
+          static_cast<char*>(mapped_ptr_) + calculate_data_size(count_)));
 
         if (!header_ptr_->initialized.load(std::memory_order_acquire)
             || header_ptr_->magic != detail::ShmHeader::SHM_MAGIC)
@@ -667,6 +682,16 @@ template<typename T>
     return std::nullopt;
 }
 
+// Creates or opens a region of count elements, which are zero when it is created
+template<typename T>
+[[nodiscard]] std::optional<SharedMemory<T>> create_shared_array(const std::string& name,
+                                                                 size_t count) noexcept {
+    SharedMemory<T> shm(name, count);
+    if (shm.open(nullptr))
+        return shm;
+    return std::nullopt;
+}
+
 }  // namespace Alexander::shm
 
 #endif  // #ifndef SHM_LINUX_H_INCLUDED
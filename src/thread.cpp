@@ -194,12 +194,16 @@ void ThreadPool::set(const NumaConfig&                           numaConfig,
         }
 
         sharedState.sharedHistories.clear();
+        sharedState.evalCaches.clear();
+        sharedState.pawnsTables.clear();
         for (auto pair : counts)
         {
             NumaIndex numaIndex = pair.first;
             uint64_t  count     = pair.second;
             auto      f         = [&]() {
                 sharedState.sharedHistories.try_emplace(numaIndex, next_power_of_two(count));
+                sharedState.evalCaches[numaIndex].resize(sharedState.options["Eval Cache"]);
+                sharedState.pawnsTables[numaIndex].resize(sharedState.options["Pawn Hash"]);
             };
             if (doBindThreads)
                 numaConfig.execute_on_numa_node(numaIndex, f);
@@ -463,4 +467,9 @@ std::vector<size_t> ThreadPool::get_bound_thread_count_by_numa_node() const {
     return counts;
 }
 
+// Returns the NUMA node of the given thread, the first one if the threads are not bound
+NumaIndex ThreadPool::get_bound_numa_node(size_t threadId) const {
+    return threadId < boundThreadToNumaNode.size() ? boundThreadToNumaNode[threadId] : 0;
+}
+
 }  // namespace Alexander
@@ -101,9 +101,9 @@ class Thread {
 
     LargePagePtr<Search::Worker> worker;
     //for classical begin
-    Pawns::Table          pawnsTable;
+    Pawns::Entry          pawnsEntry = {};
     Material::Table       materialTable;
-    Value                 bestValue;
+    Value                 bestValue = VALUE_ZERO;
     std::atomic<uint64_t> nodes;
     //for classical end
     std::function<void()> jobFunc;
@@ -160,6 +160,7 @@ class ThreadPool {
     void                   wait_for_search_finished() const;
 
     std::vector<size_t> get_bound_thread_count_by_numa_node() const;
+    NumaIndex           get_bound_numa_node(size_t threadId) const;
 
     //omitted for classical
     std::atomic_bool stop, abortedSearch, increaseDepth;
@@ -18,14 +18,26 @@
 
 #include "tt.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cinttypes>
 #include <cstdint>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <fstream>
 #include <iostream>
+#include <vector>
+
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <unistd.h>
+#endif
 
 #include "memory.h"
 #include "misc.h"
+#include "shm.h"
 #include "syzygy/tbprobe.h"
 #include "thread.h"
 
@@ -144,13 +156,212 @@ struct Cluster {
 
 static_assert(sizeof(Cluster) == 32, "Suboptimal Cluster size");
 
+// The clusters of a large page, the unit of TTPlacement::Interleave
+static constexpr size_t InterleaveClusters = 2 * 1024 * 1024 / sizeof(Cluster);
+
+
+#if defined(__linux__) && !defined(__ANDROID__)
+struct TranspositionTable::SharedTable {
+    shm::SharedMemory<Cluster> memory;
+};
+#else
+struct TranspositionTable::SharedTable {};
+#endif
+
+static_assert(sizeof(std::atomic<uint8_t>) == 1 && std::atomic<uint8_t>::is_always_lock_free);
+
+
+TranspositionTable::TranspositionTable() = default;
+
+TranspositionTable::~TranspositionTable() { free_table(); }
+
+
+// Frees a private table, allocated or mapped from a file
+static void free_private_table(Cluster* clusters, void* mappedFile, size_t mappedSize) {
+    if (mappedFile)
+    {
+#ifndef _WIN32
+        munmap(mappedFile, mappedSize);
+#else
+        (void) mappedSize;
+#endif
+    }
+    else
+        aligned_large_pages_free(clusters);
+}
+
+
+// Writes the clusters to a temporary file, deleted when it is closed. Returns nullptr
+// if the file can't be written.
+static std::FILE* spill_clusters(const Cluster* clusters, size_t count) {
+    std::FILE* file = std::tmpfile();
+
+    if (file && std::fwrite(clusters, sizeof(Cluster), count, file) != count)
+    {
+        std::fclose(file);
+        return nullptr;
+    }
+
+    return file;
+}
+
 
 // Sets the size of the transposition table,
 // measured in megabytes. Transposition table consists
 // of clusters and each cluster consists of ClusterSize number of TTEntry.
-void TranspositionTable::resize(size_t mbSize, ThreadPool& threads) {
-    aligned_large_pages_free(table);
+// The entries of a private table are carried over to the new one, through a
+// temporary file if there isn't enough memory for both tables.
+void TranspositionTable::resize(size_t             mbSize,
+                                ThreadPool&        threads,
+                                TTPlacement        tablePlacement,
+                                const std::string& sharedName) {
+    wait_for_clear();
+
+    const size_t oldCount = clusterCount;
+    Cluster*     oldTable = nullptr;
+    void*        oldFile  = nullptr;
+    size_t       oldSize  = 0;
+
+    if (table && !shared)
+    {
+        std::swap(oldTable, table);
+        std::swap(oldFile, mappedFile);
+        std::swap(oldSize, mappedSize);
+    }
+
+    free_table();
+
+    placement = tablePlacement;
+
+    // A shared table is zero when it is created, and is not cleared afterwards
+    if (!sharedName.empty() && attach_table(sharedName, mbSize))
+    {
+        free_private_table(oldTable, oldFile, oldSize);
+        return;
+    }
 
+    // A mapped table is paged from its file, and needs no memory of its own
+    const size_t available = available_memory();
+    std::FILE*   spill     = nullptr;
+
+    if (oldTable && !oldFile && available && available < mbSize * 1024 * 1024)
+    {
+        spill = spill_clusters(oldTable, oldCount);
+        free_private_table(oldTable, oldFile, oldSize);
+        oldTable = nullptr;
+    }
+
+    const uint8_t gen = generation8;
+
+    allocate_table(mbSize);
+    clear(threads);
+
+    if (oldTable || spill)
+        generation8 = gen;
+
+    if (oldTable)
+    {
+        migrate(oldTable, 0, oldCount, oldCount, threads);
+        free_private_table(oldTable, oldFile, oldSize);
+    }
+    else if (spill)
+    {
+        // Read the entries back by chunks of 64 MB
+        constexpr size_t ChunkClusters = 2 * 1024 * 1024;
+        const size_t     chunkCount    = std::min(ChunkClusters, oldCount);
+        const auto       chunk         = std::make_unique<Cluster[]>(chunkCount);
+
+        std::rewind(spill);
+
+        for (size_t first = 0; first < oldCount; first += ChunkClusters)
+        {
+            const size_t count = std::min(ChunkClusters, oldCount - first);
+
+            if (std::fread(chunk.get(), sizeof(Cluster), count, spill) != count)
+                break;
+
+            migrate(chunk.get(), first, first + count, oldCount, threads);
+        }
+
+        std::fclose(spill);
+    }
+}
+
+
+// Copies the entries of the clusters [first, last) of a table of count clusters into
+// this table. The full keys are lost, but the cluster of a key is proportional to it, so
+// that an entry goes to every cluster where its key may be: one or two when shrinking,
+// about the ratio of the sizes when growing. Each thread fills its own range of the new
+// clusters, from the old clusters whose keys may fall into it.
+void TranspositionTable::migrate(
+  const Cluster* clusters, size_t first, size_t last, size_t count, ThreadPool& threads) {
+
+    const size_t  threadCount = threads.num_threads();
+    const uint8_t gen         = generation8;
+
+    // The range of the clusters of a table of `to` clusters, where the keys of cluster i
+    // of a table of `from` clusters may be
+    auto range = [](uint64_t i, uint64_t from, uint64_t to) {
+        const uint64_t end = i + 1 == from ? to - 1 : ((i + 1) * to + from - 1) / from - 1;
+        return std::make_pair(size_t(i * to / from), size_t(end));
+    };
+
+    // An entry replaces an empty one, one with the same key16 or the least valuable one,
+    // as in probe(), if it is more valuable
+    auto value  = [gen](const TTEntry& tte) { return tte.depth8 - tte.relative_age(gen); };
+    auto insert = [&](Cluster& cluster, const TTEntry& entry) {
+        TTEntry* replace = &cluster.entry[0];
+
+        for (TTEntry& tte : cluster.entry)
+        {
+            if (!tte.is_occupied() || tte.key16 == entry.key16)
+            {
+                replace = &tte;
+                break;
+            }
+
+            if (value(tte) < value(*replace))
+                replace = &tte;
+        }
+
+        if (!replace->is_occupied() || value(entry) > value(*replace))
+            *replace = entry;
+    };
+
+    const size_t newFirst = range(first, count, clusterCount).first;
+    const size_t newLast  = range(last - 1, count, clusterCount).second + 1;
+
+    for (size_t t = 0; t < threadCount; ++t)
+    {
+        threads.run_on_thread(t, [&, t]() {
+            const size_t stride = (newLast - newFirst) / threadCount;
+            const size_t begin  = newFirst + stride * t;
+            const size_t end    = t + 1 != threadCount ? begin + stride : newLast;
+
+            if (begin == end)
+                return;
+
+            const size_t from = std::max(first, range(begin, clusterCount, count).first);
+            const size_t to   = std::min(last - 1, range(end - 1, clusterCount, count).second);
+
+            for (size_t i = from; i <= to; ++i)
+            {
+                const auto [lo, hi] = range(i, count, clusterCount);
+
+                for (const TTEntry& tte : clusters[i - first].entry)
+                    if (tte.is_occupied())
+                        for (size_t j = std::max(lo, begin); j <= std::min(hi, end - 1); ++j)
+                            insert(table[j], tte);
+            }
+        });
+    }
+
+    for (size_t t = 0; t < threadCount; ++t)
+        threads.wait_on_thread(t);
+}
+
+
+void TranspositionTable::allocate_table(size_t mbSize) {
     clusterCount = mbSize * 1024 * 1024 / sizeof(Cluster);
 
     table = static_cast<Cluster*>(aligned_large_pages_alloc(clusterCount * sizeof(Cluster)));
@@ -160,31 +371,296 @@ void TranspositionTable::resize(size_t mbSize, ThreadPool& threads) {
         std::cerr << "Failed to allocate " << mbSize << "MB for transposition table." << std::endl;
         exit(EXIT_FAILURE);
     }
+}
 
-    clear(threads);
+
+// Attaches the table to the shared memory segment of the given name and size, which the
+// first process creates. The first cluster of the segment holds the generation.
+bool TranspositionTable::attach_table(const std::string& sharedName, size_t mbSize) {
+#if defined(__linux__) && !defined(__ANDROID__)
+    char buf[64];
+    snprintf(buf, sizeof(buf), "/alx_tt_%016" PRIx64 "_%zu", hash_string(sharedName), mbSize);
+
+    const size_t count  = mbSize * 1024 * 1024 / sizeof(Cluster);
+    auto         region = shm::create_shared_array<Cluster>(buf, count + 1);
+    if (!region)
+        return false;
+
+    shared = std::make_unique<SharedTable>(SharedTable{std::move(*region)});
+
+    Cluster* clusters = const_cast<Cluster*>(&shared->memory.get());
+
+    clusterCount     = count;
+    table            = clusters + 1;
+    sharedGeneration = reinterpret_cast<std::atomic<uint8_t>*>(clusters);
+
+    return true;
+#else
+    (void) sharedName;
+    (void) mbSize;
+    return false;
+#endif
+}
+
+
+void TranspositionTable::free_table() {
+    wait_for_clear();
+
+    if (shared)
+    {
+        shared.reset();
+        sharedGeneration = nullptr;
+    }
+    else
+        free_private_table(table, mappedFile, mappedSize);
+
+    table      = nullptr;
+    mappedFile = nullptr;
+    mappedSize = 0;
 }
 
 
 // Initializes the entire transposition table to zero,
 // in a multi-threaded way.
 void TranspositionTable::clear(ThreadPool& threads) {
+    // The other processes attached to a shared table keep using it
+    if (shared)
+        return;
+
+    wait_for_clear();
+
+    // Zeroing a loaded table would read its whole file: allocate a new one instead
+    if (mappedFile)
+    {
+        const size_t mbSize = clusterCount * sizeof(Cluster) / (1024 * 1024);
+        free_table();
+        allocate_table(mbSize);
+    }
+
     generation8              = 0;
     const size_t threadCount = threads.num_threads();
 
+    // Number the NUMA nodes of the threads, and the threads of each node
+    std::vector<NumaIndex> nodes;
+    std::vector<size_t>    nodeThreads, threadNode(threadCount), threadRank(threadCount);
+
+    for (size_t i = 0; i < threadCount; ++i)
+    {
+        const NumaIndex n    = threads.get_bound_numa_node(i);
+        const size_t    node = size_t(std::find(nodes.begin(), nodes.end(), n) - nodes.begin());
+
+        if (node == nodes.size())
+        {
+            nodes.push_back(n);
+            nodeThreads.push_back(0);
+        }
+
+        threadNode[i] = node;
+        threadRank[i] = nodeThreads[node]++;
+    }
+
+    const size_t      nodeCount = nodes.size();
+    const TTPlacement place     = nodeCount > 1 ? placement : TTPlacement::Default;
+
     for (size_t i = 0; i < threadCount; ++i)
     {
-        threads.run_on_thread(i, [this, i, threadCount]() {
+        const size_t node  = threadNode[i];
+        const size_t rank  = threadRank[i];
+        const size_t peers = nodeThreads[node];
+
+        threads.run_on_thread(i, [this, i, threadCount, place, nodeCount, node, rank, peers]() {
             // Each thread will zero its part of the hash table
+            if (place == TTPlacement::Interleave)
+            {
+                // The blocks of a node are shared among its threads in turn
+                const size_t blockCount =
+                  (clusterCount + InterleaveClusters - 1) / InterleaveClusters;
+
+                for (size_t b = node + rank * nodeCount; b < blockCount; b += nodeCount * peers)
+                {
+                    const size_t start = b * InterleaveClusters;
+                    const size_t len   = std::min(InterleaveClusters, clusterCount - start);
+
+                    std::memset(&table[start], 0, len * sizeof(Cluster));
+                }
+            }
+            else if (place == TTPlacement::Partition)
+            {
+                const size_t first = clusterCount * node / nodeCount;
+                const size_t size  = clusterCount * (node + 1) / nodeCount - first;
+                const size_t start = first + size * rank / peers;
+                const size_t len   = first + size * (rank + 1) / peers - start;
+
+                std::memset(&table[start], 0, len * sizeof(Cluster));
+            }
+            else
+            {
+                const size_t stride = clusterCount / threadCount;
+                const size_t start  = stride * i;
+                const size_t len    = i + 1 != threadCount ? stride : clusterCount - start;
+
+                std::memset(&table[start], 0, len * sizeof(Cluster));
+            }
+        });
+    }
+
+    for (size_t i = 0; i < threadCount; ++i)
+        threads.wait_on_thread(i);
+}
+
+
+// Invalidates the entire table at once, and zeroes it with as many background threads
+// as the pool, so that a new game can start searching meanwhile. The entries written
+// before are told apart by their generation, and ignored until they are zeroed. Their
+// generation may alias a newer one, which lets a few of them through: they are still
+// valid, only not as deterministic as an empty table.
+void TranspositionTable::clear_in_background(ThreadPool& threads) {
+    if (shared)
+        return;
+
+    if (mappedFile)
+    {
+        clear(threads);
+        return;
+    }
+
+    wait_for_clear();
+
+    const size_t threadCount = threads.num_threads();
+
+    generation8 += GENERATION_DELTA;
+    clearGeneration8 = generation8;
+    pendingClearers.store(threadCount, std::memory_order_release);
+
+    for (size_t i = 0; i < threadCount; ++i)
+        clearers.emplace_back([this, i, threadCount]() {
             const size_t stride = clusterCount / threadCount;
             const size_t start  = stride * i;
             const size_t len    = i + 1 != threadCount ? stride : clusterCount - start;
 
             std::memset(&table[start], 0, len * sizeof(Cluster));
+            pendingClearers.fetch_sub(1, std::memory_order_release);
         });
+}
+
+
+void TranspositionTable::wait_for_clear() {
+    for (std::thread& th : clearers)
+        th.join();
+
+    clearers.clear();
+}
+
+
+// Tells whether an entry was written before the pending background clear
+bool TranspositionTable::is_stale(const TTEntry& tte) const {
+    if (!pendingClearers.load(std::memory_order_relaxed))
+        return false;
+
+    const uint8_t gen = generation();
+
+    return tte.relative_age(gen) > ((GENERATION_CYCLE + gen - clearGeneration8) & GENERATION_MASK);
+}
+
+
+// The header of a saved table. The clusters follow at TTFileHeaderSize bytes, so that
+// they are page aligned when the file is mapped.
+struct TTFileHeader {
+    char     magic[8];
+    uint64_t clusterCount;
+    uint32_t clusterSize;
+    uint8_t  generation8;
+};
+
+static constexpr char   TTFileMagic[8]   = {'A', 'L', 'X', 'H', 'A', 'S', 'H', '1'};
+static constexpr size_t TTFileHeaderSize = 4096;
+
+static_assert(sizeof(TTFileHeader) <= TTFileHeaderSize);
+
+
+// Writes the header and the clusters of the table to the given file.
+bool TranspositionTable::save(const std::string& fileName) {
+    wait_for_clear();
+
+    std::ofstream file(fileName, std::ios::binary);
+    if (!file)
+        return false;
+
+    char         header[TTFileHeaderSize] = {};
+    TTFileHeader fileHeader{};
+
+    std::memcpy(fileHeader.magic, TTFileMagic, sizeof(TTFileMagic));
+    fileHeader.clusterCount = clusterCount;
+    fileHeader.clusterSize  = sizeof(Cluster);
+    fileHeader.generation8  = generation();
+    std::memcpy(header, &fileHeader, sizeof(fileHeader));
+
+    file.write(header, sizeof(header));
+    file.write(reinterpret_cast<const char*>(table),
+               std::streamsize(clusterCount * sizeof(Cluster)));
+
+    return bool(file);
+}
+
+
+// Replaces the table with the one saved in the given file, which must have the same
+// size. The file is mapped copy-on-write, so that its clusters are read when they are
+// first probed, and the search writes to private copies of them.
+bool TranspositionTable::load(const std::string& fileName) {
+    wait_for_clear();
+
+    TTFileHeader fileHeader{};
+    const size_t tableSize = clusterCount * sizeof(Cluster);
+
+    std::ifstream file(fileName, std::ios::binary | std::ios::ate);
+    if (!file || size_t(file.tellg()) != TTFileHeaderSize + tableSize)
+        return false;
+
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(&fileHeader), sizeof(fileHeader));
+
+    if (!file || std::memcmp(fileHeader.magic, TTFileMagic, sizeof(TTFileMagic))
+        || fileHeader.clusterCount != clusterCount || fileHeader.clusterSize != sizeof(Cluster))
+        return false;
+
+#ifndef _WIN32
+    if (!shared)
+    {
+        const int fd = ::open(fileName.c_str(), O_RDONLY);
+        if (fd == -1)
+            return false;
+
+        void* mapping =
+          mmap(nullptr, TTFileHeaderSize + tableSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+
+        if (mapping == MAP_FAILED)
+            return false;
+
+        free_table();
+
+        mappedFile  = mapping;
+        mappedSize  = TTFileHeaderSize + tableSize;
+        table       = reinterpret_cast<Cluster*>(static_cast<char*>(mapping) + TTFileHeaderSize);
+        generation8 = fileHeader.generation8;
+
+        return true;
     }
+#endif
 
-    for (size_t i = 0; i < threadCount; ++i)
-        threads.wait_on_thread(i);
+    // Without a copy-on-write mapping, the clusters are read into the current table
+    file.seekg(TTFileHeaderSize);
+    file.read(reinterpret_cast<char*>(table), std::streamsize(tableSize));
+
+    if (!file)
+        return false;
+
+    if (sharedGeneration)
+        sharedGeneration->store(fileHeader.generation8, std::memory_order_relaxed);
+    else
+        generation8 = fileHeader.generation8;
+
+    return true;
 }
 
 
@@ -192,24 +668,38 @@ void TranspositionTable::clear(ThreadPool& threads) {
 // occupation during a search. The hash is x permill full, as per UCI protocol.
 // Only counts entries which match the current generation.
 int TranspositionTable::hashfull(int maxAge) const {
-    int maxAgeInternal = maxAge << GENERATION_BITS;
-    int cnt            = 0;
+    int           maxAgeInternal = maxAge << GENERATION_BITS;
+    int           cnt            = 0;
+    const uint8_t gen            = generation();
     for (int i = 0; i < 1000; ++i)
         for (int j = 0; j < ClusterSize; ++j)
             cnt += table[i].entry[j].is_occupied()
-                && table[i].entry[j].relative_age(generation8) <= maxAgeInternal;
+                && table[i].entry[j].relative_age(gen) <= maxAgeInternal
+                && !is_stale(table[i].entry[j]);
 
     return cnt / ClusterSize;
 }
 
 
 void TranspositionTable::new_search() {
+    // Before the generations wrap around to those of the stale entries, let the
+    // background clear finish
+    if (pendingClearers.load(std::memory_order_acquire)
+        && ((GENERATION_CYCLE + generation8 - clearGeneration8) & GENERATION_MASK)
+             >= GENERATION_MASK / 2)
+        wait_for_clear();
+
     // increment by delta to keep lower bits as is
-    generation8 += GENERATION_DELTA;
+    if (sharedGeneration)
+        sharedGeneration->fetch_add(GENERATION_DELTA, std::memory_order_relaxed);
+    else
+        generation8 += GENERATION_DELTA;
 }
 
 
-uint8_t TranspositionTable::generation() const { return generation8; }
+uint8_t TranspositionTable::generation() const {
+    return sharedGeneration ? sharedGeneration->load(std::memory_order_relaxed) : generation8;
+}
 
 
 // Looks up the current position in the transposition
@@ -224,16 +714,17 @@ std::tuple<bool, TTData, TTWriter> TranspositionTable::probe(const Key key) cons
     const uint16_t key16 = uint16_t(key);  // Use the low 16 bits as key inside the cluster
 
     for (int i = 0; i < ClusterSize; ++i)
-        if (tte[i].key16 == key16)
+        if (tte[i].key16 == key16 && !is_stale(tte[i]))
             // This gap is the main place for read races.
             // After `read()` completes that copy is final, but may be self-inconsistent.
             return {tte[i].is_occupied(), tte[i].read(), TTWriter(&tte[i])};
 
     // Find an entry to be replaced according to the replacement strategy
-    TTEntry* replace = tte;
+    TTEntry*      replace = tte;
+    const uint8_t gen     = generation();
     for (int i = 1; i < ClusterSize; ++i)
-        if (replace->depth8 - replace->relative_age(generation8)
-            > tte[i].depth8 - tte[i].relative_age(generation8))
+        if (replace->depth8 - replace->relative_age(gen)
+            > tte[i].depth8 - tte[i].relative_age(gen))
             replace = &tte[i];
 
     return {false,
@@ -20,8 +20,13 @@
 #define TT_H_INCLUDED
 
 #include <cstddef>
+#include <atomic>
 #include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
 #include <tuple>
+#include <vector>
 
 #include "memory.h"
 #include "types.h"
@@ -78,13 +83,31 @@ struct TTWriter {
 };
 
 
+// How a new table is placed on the NUMA nodes of the threads. A page is allocated on
+// the node of the thread zeroing it first, and the threads of each node zero its part.
+enum class TTPlacement {
+    Default,     // Each thread zeroes a chunk, whatever its node
+    Interleave,  // The nodes alternate every 2 MB
+    Partition    // Each node holds a contiguous range of the table, that is of the keys
+};
+
+
 class TranspositionTable {
 
    public:
-    ~TranspositionTable() { aligned_large_pages_free(table); }
-
-    void resize(size_t mbSize, ThreadPool& threads);  // Set TT size
+    TranspositionTable();
+    ~TranspositionTable();
+
+    // Set TT size, and attach it to the named shared memory segment if any
+    void resize(size_t             mbSize,
+                ThreadPool&        threads,
+                TTPlacement        placement = TTPlacement::Default,
+                const std::string& sharedName = "");
     void clear(ThreadPool& threads);                  // Re-initialize memory, multithreaded
+    void clear_in_background(ThreadPool& threads);    // Invalidate at once, zero meanwhile
+    bool save(const std::string& fileName);           // Write the table to a file
+    bool load(const std::string& fileName);  // Read a table of the same size, mapped lazily
+    bool is_shared() const { return shared != nullptr; }
     int  hashfull(int maxAge = 0)
       const;  // Approximate what fraction of entries (permille) have been written to during this root search
 
@@ -99,8 +122,33 @@ class TranspositionTable {
    private:
     friend struct TTEntry;
 
-    size_t   clusterCount;
-    Cluster* table = nullptr;
+    struct SharedTable;
+
+    void allocate_table(size_t mbSize);
+    bool attach_table(const std::string& sharedName, size_t mbSize);
+    void free_table();
+    void migrate(
+      const Cluster* clusters, size_t first, size_t last, size_t count, ThreadPool& threads);
+    void wait_for_clear();
+    bool is_stale(const TTEntry& tte) const;
+
+    size_t      clusterCount;
+    Cluster*    table     = nullptr;
+    TTPlacement placement = TTPlacement::Default;
+
+    // A loaded table is a private mapping of its file, and is not freed as an allocation
+    void*  mappedFile = nullptr;
+    size_t mappedSize = 0;
+
+    // A shared table keeps its generation in the segment, for all the processes
+    std::unique_ptr<SharedTable> shared;
+    std::atomic<uint8_t>*        sharedGeneration = nullptr;
+
+    // While a background clear zeroes the table, the entries of the generations before
+    // clearGeneration8 are ignored
+    std::vector<std::thread> clearers;
+    std::atomic<size_t>      pendingClearers{0};
+    uint8_t                  clearGeneration8 = 0;
 
     uint8_t generation8 = 0;  // Size must be not bigger than TTEntry::genBound8
 };
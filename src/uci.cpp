@@ -22,6 +22,7 @@
 #include <cctype>
 #include <cmath>
 #include <cstdint>
+#include <iomanip>
 #include <iterator>
 #include <optional>
 #include <sstream>
@@ -30,6 +31,7 @@
 #include <vector>
 
 #include "benchmark.h"
+#include "endgame.h"
 #include "engine.h"
 #include "memory.h"
 #include "movegen.h"
@@ -182,7 +184,8 @@ void UCIEngine::loop() {
                 }
                 setStartPoint();
             }
-            engine.search_clear();
+            // Don't delay "isready" while a large hash is zeroed
+            engine.search_clear(false);
         }
         //learning end
         else if (token == "isready")
@@ -196,6 +199,25 @@ void UCIEngine::loop() {
             bench(is);
         else if (token == BenchmarkCommand)
             benchmark(is);
+        else if (token == "mctsbench")
+            mcts_benchmark(is);
+        else if (token == "mctsreuse")
+            mcts_reuse_benchmark(is);
+        else if (token == "mctsbackupbench")
+            mcts_backup_benchmark(is);
+        else if (token == "ttbench")
+            tt_benchmark(is);
+        else if (token == "egbench")
+            endgame_benchmark(is);
+        else if (token == "mctssave" || token == "mctsload")
+            mcts_snapshot(token, is);
+        else if (token == "savehash" || token == "loadhash")
+            tt_snapshot(token, is);
+        else if (token == "mctsstats")
+        {
+            engine.wait_for_search_finished();
+            sync_cout << MCTS.stats(pos) << sync_endl;
+        }
         else if (token == "d")
             sync_cout << engine.visualize() << sync_endl;
         else if (token == "eval")
@@ -206,7 +228,14 @@ void UCIEngine::loop() {
         else if (token == "showexp")
             LD.show_exp(pos);
         else if (token == "quickresetexp")
-            LD.quick_reset_exp();
+        {
+            std::istringstream recompute("recompute");
+            maintain_experience(recompute);
+        }
+        else if (token == "mergeexp")
+            merge_experience(is);
+        else if (token == "maintainexp")
+            maintain_experience(is);
         //book and exp end
         else if (token == "compiler")
             sync_cout << compiler_info() << sync_endl;
@@ -305,8 +334,9 @@ void UCIEngine::go(std::istringstream& is) {
 void UCIEngine::bench(std::istream& args) {
     std::string token;
     uint64_t    num, nodes = 0, cnt = 1;
-    uint64_t    nodesSearched = 0;
-    const auto& options       = engine.get_options();
+    uint64_t    nodesSearched   = 0;
+    uint64_t    evalCacheProbes = 0, evalCacheHits = 0;
+    const auto& options         = engine.get_options();
 
     engine.set_on_update_full([&](const auto& i) {
         nodesSearched = i.nodes;
@@ -337,8 +367,13 @@ void UCIEngine::bench(std::istream& args) {
                     nodesSearched = perft(limits, nullptr);  //from classical
                 else
                 {
+                    const auto [probes, hits] = engine.eval_cache_stats();
+
                     engine.go(limits);
                     engine.wait_for_search_finished();
+
+                    evalCacheProbes += engine.eval_cache_stats().first - probes;
+                    evalCacheHits += engine.eval_cache_stats().second - hits;
                 }
 
                 nodes += nodesSearched;
@@ -375,7 +410,10 @@ void UCIEngine::bench(std::istream& args) {
     std::cerr << "\n==========================="    //
               << "\nTotal time (ms) : " << elapsed  //
               << "\nNodes searched  : " << nodes    //
-              << "\nNodes/second    : " << 1000 * nodes / elapsed << std::endl;
+              << "\nNodes/second    : " << 1000 * nodes / elapsed  //
+              << "\nEval cache hits : "
+              << (evalCacheProbes ? 100.0 * evalCacheHits / evalCacheProbes : 0) << '%'
+              << std::endl;
 
     // reset callback, to not capture a dangling reference to nodesSearched
     engine.set_on_update_full([&](const auto& i) { on_update_full(i, options["UCI_ShowWDL"]); });
@@ -538,6 +576,360 @@ void UCIEngine::benchmark(std::istream& args) {
     init_search_update_listeners();
 }
 
+void UCIEngine::mcts_benchmark(std::istream& args) {
+    std::string token;
+
+    engine.set_on_update_full([](const auto&) {});
+    engine.set_on_iter([](const auto&) {});
+    engine.set_on_update_no_moves([](const auto&) {});
+    engine.set_on_bestmove([](const auto&, const auto&) {});
+
+    Benchmark::MCTSBenchmarkSetup setup = Benchmark::setup_mcts_benchmark(args);
+
+    auto set = [&](const std::string& name, const std::string& value) {
+        auto ss = std::istringstream("name " + name + " value " + value);
+        setoption(ss);
+    };
+
+    set("Hash", std::to_string(setup.ttSize));
+    set("MCTS by Shashin", "true");
+    set("MCTS Explore", "true");
+
+    // The leaves are the nodes expanded by the playouts. As each node is expanded
+    // only once, the threads exploring the same leaves concurrently lower the ratio
+    // of leaves per playout.
+    std::cerr << "\nMCTS threads   Playouts     Leaves   Time (ms)   Playouts/second"
+              << "   Leaves/second" << std::endl;
+
+    for (int threadCount : setup.mctsThreads)
+    {
+        // The main thread always runs alpha-beta, so add one thread for it
+        set("Threads", std::to_string(threadCount + 1));
+        set("MCTSThreads", std::to_string(threadCount));
+        engine.search_clear();
+
+        TimePoint elapsed  = 0;
+        size_t    playouts = 0;
+        size_t    leaves   = 0;
+
+        for (const auto& cmd : setup.commands)
+        {
+            std::istringstream is(cmd);
+            is >> std::skipws >> token;
+
+            if (token == "go")
+            {
+                Search::LimitsType limits = parse_limits(is);
+
+                // Each position starts with an empty tree
+                MCTS.clear();
+
+                const size_t before       = MCTSPlayouts;
+                const size_t leavesBefore = MCTSExpansions;
+                TimePoint    start        = now();
+
+                engine.go(limits);
+                engine.wait_for_search_finished();
+
+                elapsed += now() - start;
+                playouts += MCTSPlayouts - before;
+                leaves += MCTSExpansions - leavesBefore;
+            }
+            else if (token == "setoption")
+                setoption(is);
+            else if (token == "position")
+                position(is);
+        }
+
+        elapsed = std::max<TimePoint>(elapsed, 1);  // Ensure positivity to avoid a 'divide by zero'
+
+        std::cerr << std::setw(12) << threadCount << std::setw(11) << playouts << std::setw(11)
+                  << leaves << std::setw(12) << elapsed << std::setw(18)
+                  << 1000 * playouts / elapsed << std::setw(16) << 1000 * leaves / elapsed
+                  << std::endl;
+    }
+
+    init_search_update_listeners();
+}
+
+void UCIEngine::mcts_reuse_benchmark(std::istream& args) {
+    std::string token;
+
+    engine.set_on_update_full([](const auto&) {});
+    engine.set_on_iter([](const auto&) {});
+    engine.set_on_update_no_moves([](const auto&) {});
+    engine.set_on_bestmove([](const auto&, const auto&) {});
+
+    Benchmark::MCTSBenchmarkSetup setup = Benchmark::setup_mcts_reuse_benchmark(args);
+
+    auto set = [&](const std::string& name, const std::string& value) {
+        auto ss = std::istringstream("name " + name + " value " + value);
+        setoption(ss);
+    };
+
+    // The main thread always runs alpha-beta, so add one thread for it
+    set("Hash", std::to_string(setup.ttSize));
+    set("Threads", std::to_string(setup.mctsThreads[0] + 1));
+    set("MCTSThreads", std::to_string(setup.mctsThreads[0]));
+    set("MCTS by Shashin", "true");
+    set("MCTS Explore", "true");
+
+    std::cerr << "\nMove   Carried visits   Playouts" << std::endl;
+
+    int    moves    = 0;
+    long   carried  = 0;
+    size_t playouts = 0;
+
+    for (const auto& cmd : setup.commands)
+    {
+        std::istringstream is(cmd);
+        is >> std::skipws >> token;
+
+        if (token == "go")
+        {
+            Search::LimitsType limits = parse_limits(is);
+
+            const size_t before = MCTSPlayouts;
+
+            engine.go(limits);
+            engine.wait_for_search_finished();
+
+            ++moves;
+            carried += MCTS.reused_visits();
+            playouts += MCTSPlayouts - before;
+
+            std::cerr << std::setw(4) << moves << std::setw(17) << MCTS.reused_visits()
+                      << std::setw(11) << MCTSPlayouts - before << std::endl;
+        }
+        else if (token == "ucinewgame")
+            engine.search_clear();
+        else if (token == "position")
+            position(is);
+    }
+
+    moves = std::max(moves, 1);  // Ensure positivity to avoid a 'divide by zero'
+
+    std::cerr << "\nAverage carried visits per move: " << carried / moves
+              << "\nAverage playouts per move      : " << playouts / moves << std::endl;
+
+    init_search_update_listeners();
+}
+
+// The "mctsbackupbench [maxThreads=8] [millis=1000]" command measures the throughput
+// of the updates of the MCTS statistics, with 1, 2, 4, ... threads up to maxThreads.
+void UCIEngine::mcts_backup_benchmark(std::istream& args) {
+    int       maxThreads;
+    TimePoint millis;
+
+    if (!(args >> maxThreads))
+        maxThreads = 8;
+
+    if (!(args >> millis))
+        millis = 1000;
+
+    backup_benchmark(maxThreads, millis);
+}
+
+// The "egbench [probes=100000000]" command compares the cost of the lookups of the
+// endgame evaluation and scaling functions in their table and in a hash map.
+void UCIEngine::endgame_benchmark(std::istream& args) {
+    uint64_t probes;
+
+    if (!(args >> probes))
+        probes = 100000000;
+
+    Endgames::benchmark(probes);
+}
+
+// The "ttbench [ttSize=1024] [threads] [movetime=1000]" command compares the NUMA
+// placements of the transposition table, by the latency of its probes and the nodes
+// per second of the search. The placements differ only with threads bound to several
+// NUMA nodes.
+void UCIEngine::tt_benchmark(std::istream& args) {
+    std::string token;
+    uint64_t    nodesSearched = 0;
+
+    engine.set_on_update_full([&](const Engine::InfoFull& i) { nodesSearched = i.nodes; });
+    engine.set_on_iter([](const auto&) {});
+    engine.set_on_update_no_moves([](const auto&) {});
+    engine.set_on_bestmove([](const auto&, const auto&) {});
+
+    Benchmark::TTBenchmarkSetup setup = Benchmark::setup_tt_benchmark(args);
+
+    auto set = [&](const std::string& name, const std::string& value) {
+        auto ss = std::istringstream("name " + name + " value " + value);
+        setoption(ss);
+    };
+
+    set("Threads", std::to_string(setup.threads));
+    set("Hash", std::to_string(setup.ttSize));
+
+    std::string threadBinding = engine.thread_binding_information_as_string();
+    if (threadBinding.empty())
+        threadBinding = "none";
+
+    std::cerr << "\nAvailable processors : " << engine.get_numa_config_as_string()
+              << "\nThread binding       : " << threadBinding
+              << "\n\nPlacement    Probe latency (ns)   Nodes/second" << std::endl;
+
+    for (const std::string placement : {"Default", "Interleave", "Partition"})
+    {
+        // The table is allocated again, and placed when it is first zeroed
+        set("Hash NUMA Placement", placement);
+
+        const double latency = engine.tt_probe_latency(setup.probes);
+        TimePoint    elapsed = 0;
+        uint64_t     nodes   = 0;
+
+        for (const auto& cmd : setup.commands)
+        {
+            std::istringstream is(cmd);
+            is >> std::skipws >> token;
+
+            if (token == "go")
+            {
+                Search::LimitsType limits = parse_limits(is);
+
+                nodesSearched   = 0;
+                TimePoint start = now();
+
+                engine.go(limits);
+                engine.wait_for_search_finished();
+
+                elapsed += now() - start;
+                nodes += nodesSearched;
+            }
+            else if (token == "position")
+                position(is);
+            else if (token == "ucinewgame")
+                engine.search_clear();
+        }
+
+        elapsed = std::max<TimePoint>(elapsed, 1);  // Ensure positivity to avoid a 'divide by zero'
+
+        std::cerr << std::left << std::setw(13) << placement << std::right << std::setw(18)
+                  << std::lround(latency) << std::setw(15) << 1000 * nodes / elapsed << std::endl;
+    }
+
+    init_search_update_listeners();
+}
+
+// The "mctssave <file>" and "mctsload <file>" commands save the MCTS tree to a
+// file and load it back, so that a long analysis can be resumed on the same position.
+void UCIEngine::mcts_snapshot(const std::string& command, std::istream& args) {
+    std::string fileName;
+
+    engine.wait_for_search_finished();
+
+    if (!std::getline(args >> std::ws, fileName) || fileName.empty())
+    {
+        sync_cout << "info string Usage: " << command << " <file>" << sync_endl;
+        return;
+    }
+
+    if (command == "mctssave")
+    {
+        if (MCTS.save(fileName))
+            sync_cout << "info string MCTS tree saved to " << fileName << sync_endl;
+        else
+            sync_cout << "info string Unable to save the MCTS tree to " << fileName << sync_endl;
+    }
+    else
+    {
+        MCTS.reserve(size_t(int(engine.get_options()["MCTS Hash"])));
+
+        if (MCTS.load(fileName))
+            sync_cout << "info string MCTS tree loaded from " << fileName << sync_endl;
+        else
+            sync_cout << "info string Unable to load the MCTS tree from " << fileName << sync_endl;
+    }
+}
+
+// The "savehash <file>" and "loadhash <file>" commands save the transposition table to
+// a file and load it back. The loaded table is mapped from the file, which is read
+// lazily as the search probes it, and must have been saved with the same Hash size.
+void UCIEngine::tt_snapshot(const std::string& command, std::istream& args) {
+    std::string fileName;
+
+    if (!std::getline(args >> std::ws, fileName) || fileName.empty())
+    {
+        sync_cout << "info string Usage: " << command << " <file>" << sync_endl;
+        return;
+    }
+
+    if (command == "savehash")
+    {
+        if (engine.save_tt(fileName))
+            sync_cout << "info string Hash saved to " << fileName << sync_endl;
+        else
+            sync_cout << "info string Unable to save the hash to " << fileName << sync_endl;
+    }
+    else
+    {
+        if (engine.load_tt(fileName))
+            sync_cout << "info string Hash loaded from " << fileName << sync_endl;
+        else
+            sync_cout << "info string Unable to load the hash from " << fileName
+                      << " (it must be saved with the current Hash size)" << sync_endl;
+    }
+}
+
+// The "mergeexp [file ...]" command merges experience files, for instance those written
+// with Concurrent Experience, into experience.exp. The merged files are kept.
+void UCIEngine::merge_experience(std::istream& args) {
+    std::vector<std::string> fileNames;
+    std::string              fileName;
+
+    engine.wait_for_search_finished();
+
+    while (args >> fileName)
+        fileNames.push_back(fileName);
+
+    const TimePoint start = now();
+
+    if (LD.merge(fileNames))
+        sync_cout << "info string Merged " << fileNames.size() << " experience files in "
+                  << now() - start << " ms" << sync_endl;
+    else
+        sync_cout << "info string Unable to merge the experience files" << sync_endl;
+}
+
+// The "maintainexp [recompute] [prune <depth>] [clean] [stats]" command runs the given
+// tasks over the experience, with the search threads: recompute the performances,
+// prune the moves below a depth, remove the invalid and duplicate moves, and print
+// the depth and score histograms.
+void UCIEngine::maintain_experience(std::istream& args) {
+    ExperienceMaintenance tasks;
+    std::string           token;
+
+    while (args >> token)
+    {
+        if (token == "recompute")
+            tasks.recompute = true;
+        else if (token == "prune" && args >> tasks.minDepth)
+            continue;
+        else if (token == "clean")
+            tasks.clean = true;
+        else if (token == "stats")
+            tasks.stats = true;
+        else
+        {
+            sync_cout << "info string Usage: maintainexp [recompute] [prune <depth>] [clean]"
+                         " [stats]"
+                      << sync_endl;
+            return;
+        }
+    }
+
+    const TimePoint start = now();
+
+    if (engine.maintain_experience(tasks))
+        sync_cout << "info string Experience maintained in " << now() - start << " ms"
+                  << sync_endl;
+    else
+        sync_cout << "info string Unable to maintain the experience" << sync_endl;
+}
+
 void UCIEngine::setoption(std::istringstream& is) {
     engine.wait_for_search_finished();
     engine.get_options().setoption(is);
@@ -674,12 +1066,16 @@ void UCIEngine::on_update_full(const Engine::InfoFull& info, bool showWDL) {
     if (showWDL)
         ss << " wdl " << info.wdl;
 
-    ss << " nodes " << info.nodes        //
-       << " nps " << info.nps            //
-       << " hashfull " << info.hashfull  //
-       << " tbhits " << info.tbHits      //
-       << " time " << info.timeMs        //
-       << " pv " << info.pv;             //
+    ss << " nodes " << info.nodes         //
+       << " nps " << info.nps             //
+       << " hashfull " << info.hashfull;  //
+
+    if (info.mctsfull >= 0)
+        ss << " mctsfull " << info.mctsfull;
+
+    ss << " tbhits " << info.tbHits  //
+       << " time " << info.timeMs    //
+       << " pv " << info.pv;         //
 
     sync_cout << ss.str() << sync_endl;
 }
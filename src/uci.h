@@ -65,6 +65,15 @@ class UCIEngine {
     void          go(std::istringstream& is);
     void          bench(std::istream& args);
     void          benchmark(std::istream& args);
+    void          mcts_benchmark(std::istream& args);
+    void          mcts_reuse_benchmark(std::istream& args);
+    void          mcts_backup_benchmark(std::istream& args);
+    void          tt_benchmark(std::istream& args);
+    void          endgame_benchmark(std::istream& args);
+    void          mcts_snapshot(const std::string& command, std::istream& args);
+    void          tt_snapshot(const std::string& command, std::istream& args);
+    void          merge_experience(std::istream& args);
+    void          maintain_experience(std::istream& args);
     void          position(std::istringstream& is);
     void          setoption(std::istringstream& is);
     std::uint64_t perft(const Search::LimitsType& limits, Thread* th);  //for classical